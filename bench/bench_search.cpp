@@ -0,0 +1,102 @@
+// Description: times the search engine on a directory tree.
+//
+//              bench_search [DIR [RUNS]]
+//
+//              without DIR, a tree of 100k empty files is generated (and
+//              removed afterwards).  the first run of each case warms the
+//              page cache and is not counted.
+//
+// Author:     Austin Fite
+// Contact:    akfite@gmail.com
+// Date:       2024
+
+#include "fsfind_engine.h"
+
+#include <random>
+
+struct bench_case
+{
+    const char* name;
+    search_options opts;
+};
+
+// dirs/dirs/files, with names of varying length
+inline void make_tree(const fs::path& root, size_t files)
+{
+    std::mt19937 rng(42);
+    const size_t per_dir = 100;
+    for (size_t i = 0; i < files; i++)
+    {
+        const size_t d = i / per_dir;
+        const fs::path dir = root / ("d" + std::to_string(d / 32)) / ("d" + std::to_string(d % 32));
+        if (i % per_dir == 0)
+        {
+            fs::create_directories(dir);
+        }
+
+        std::string name = "file_" + std::to_string(i) + "_";
+        name.append(rng() % 24, 'x');
+        std::fclose(std::fopen((dir / name).string().c_str(), "w"));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    fs::path root;
+    bool generated = false;
+    if (argc > 1)
+    {
+        root = argv[1];
+    }
+    else
+    {
+        root = fs::temp_directory_path() / ("fsfind_bench_" + std::to_string(std::random_device()()));
+        std::printf("generating %s\n", root.string().c_str());
+        make_tree(root, 100000);
+        generated = true;
+    }
+    const int runs = argc > 2 ? std::max(1, std::atoi(argv[2])) : 5;
+
+    std::vector<bench_case> cases;
+    auto add = [&](const char* name)
+    {
+        cases.push_back({name, search_options()});
+        cases.back().opts.depth = std::numeric_limits<double>::infinity();
+        return &cases.back().opts;
+    };
+
+    add("crawl");
+    add("crawl, 1 reader")->max_concurrency = 1;
+    add("pattern")->pattern = "_1\\d*_";
+    add("sort natural")->sort = sort_key::natural;
+    search_options* sized = add("sort size");
+    sized->sort = sort_key::size;
+    sized->collect_stats = true;
+    add("memory limit 4 MiB")->memory_limit = 4 << 20;
+
+    std::printf("%-22s %10s %10s %14s\n", "case", "min (ms)", "median", "entries/s");
+    for (const bench_case& c : cases)
+    {
+        search({root}, c.opts);
+
+        std::vector<double> times;
+        size_t entries = 0;
+        for (int r = 0; r < runs; r++)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            const search_results results = search({root}, c.opts);
+            times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            entries = results.stats.entries;
+        }
+
+        std::sort(times.begin(), times.end());
+        std::printf("%-22s %10.1f %10.1f %14.0f\n", c.name, times.front() * 1e3, times[times.size() / 2] * 1e3,
+            entries / times[times.size() / 2]);
+    }
+
+    if (generated)
+    {
+        fs::remove_all(root);
+    }
+    return 0;
+}
@@ -1,4 +1,4 @@
-function [files, filenames, types] = fsfind(parent_dir, pattern, opts)
+function [files, filenames, types, lines, hashes, info, errors, links] = fsfind(parent_dir, pattern, opts)
 %FSFIND Fast recursive filesystem search with regular expression support.
 %
 %   Usage:
@@ -8,12 +8,19 @@ function [files, filenames, types] = fsfind(parent_dir, pattern, opts)
 %       FILES = FSFIND(PARENT_DIR, PATTERN)
 %       FILES = FSFIND(PARENT_DIR, PATTERN, options...)
 %       [FILES, FILENAMES, TYPES] = FSFIND(_____)
+%       [FILES, FILENAMES, TYPES, LINES, HASHES] = FSFIND(_____)
+%       [FILES, FILENAMES, TYPES, LINES, HASHES, INFO] = FSFIND(_____)
+%       [FILES, FILENAMES, TYPES, LINES, HASHES, INFO, ERRORS] = FSFIND(_____)
+%       [FILES, FILENAMES, TYPES, LINES, HASHES, INFO, ERRORS, LINKS] = FSFIND(_____)
 %
 %
 %   Inputs:
 %
 %       PARENT_DIR <Nx1 string>
 %           - one or more directories to search
+%           - results are returned directory by directory; anything found
+%             under more than one of them (e.g. when one is inside another)
+%             is only returned once
 %
 %       PATTERN <Nx1 string>
 %           - text to match against filenames
@@ -39,13 +46,156 @@ function [files, filenames, types] = fsfind(parent_dir, pattern, opts)
 %             depth.  e.g. for applying a filter only to the second folder
 %             level, we may set this to {'', 'whatever'}
 %
+%       'Exclude' (=string.empty) <Nx1 string>
+%           - names to drop from the search entirely (files and directories)
+%           - excluded directories are never opened, so this is the fastest
+%             way to skip subtrees like .git or node_modules at any depth
+%           - each entry is a wildcard pattern by default (e.g. "*.tmp"); see
+%             'ExcludeSyntax'
+%
+%       'ExcludeDirs' (=string.empty) <Nx1 string>
+%           - like 'Exclude', but only applied to directories
+%
+%       'ExcludeSyntax' (='glob') <1xN char>
+%           - 'glob'  : 'Exclude' & 'ExcludeDirs' match the whole name using
+%                       the wildcards *, ? and [...]
+%           - 'regex' : they are regular expressions (partial match, like PATTERN)
+%
+%       'ContainsText' (="") <1x1 string>
+%           - only return regular files whose contents contain this text
+%           - honors 'CaseSensitive' (ASCII case folding only)
+%
+%       'ContainsRegex' (="") <1x1 string>
+%           - only return regular files with a line that matches this regular
+%             expression (takes precedence over 'ContainsText')
+%
+%       'Sort' (='none') <1xN char>
+%           - order of the results (ties are always broken by path):
+%               'none'    : the order the filesystem listed them in
+%               'path'    : full path, byte order
+%               'name'    : file name, byte order
+%               'natural' : full path, with numbers compared by value
+%                           (file2 before file10) and case ignored
+%               'size'    : file size, smallest first
+%               'mtime'   : modification time, oldest first
+%           - 'natural', 'size' and 'mtime' require the MEX code
+%
+%       'RelativePaths' (=false) <1x1 logical>
+%           - return paths relative to the PARENT_DIR they were found under
+%             (e.g. "sub/file.txt" rather than "/data/root/sub/file.txt")
+%           - with 'Output','tree', the directories are relative too (and
+%             PARENT_DIR itself is "")
+%
+%       'Output' (='paths') <1xN char>
+%           - 'paths' : FILES is a string array of full paths
+%           - 'tree'  : FILES is a compact struct that stores each directory
+%                       once instead of repeating it in every path (see FILES
+%                       below); use fsfind_expand to get full paths for any
+%                       subset of the results
+%
+%       'RawNames' (=false) <1x1 logical>
+%           - return the bytes of every path exactly as the filesystem holds
+%             them, without converting them to strings at all (see FILES
+%             below); this is the fastest way to get the results, and the
+%             only lossless one for names that are not valid UTF-8 (e.g.
+%             Latin-1 names on old shares)
+%           - use fsfind_decode to get strings for any subset of the results,
+%             in any encoding
+%           - cannot be combined with 'Output','tree'
+%
+%       'UniqueInodes' (=false) <1x1 logical>
+%           - return a file with several hard links (e.g. in backup snapshots)
+%             only once, at the first of its paths in the results (i.e. in
+%             'Sort' order); directories are never dropped
+%           - a symbolic link to such a file counts as one of its paths
+%           - requires the MEX code
+%
+%       'Hash' (='none') <1xN char>
+%           - computes a digest of each regular file that is returned:
+%             'none', 'xxh3' (XXH3-64, very fast) or 'sha256'
+%           - requires the MEX code
+%
+%       'Threads' (=0) <1x1 integer>
+%           - number of worker threads used by the MEX code to search contents,
+%             hash & sort files; 0 uses one per hardware thread
+%           - when set, it also caps the number of directories read at once
+%             (see 'Concurrency')
+%
+%       'Concurrency' (=[1 64]) <1x2 integer>
+%           - bounds on the number of directories the MEX code reads at once
+%           - within these bounds, the number is adjusted during the search
+%             from the measured throughput: it grows on slow network or
+%             parallel filesystems, where each read mostly waits, and shrinks
+%             on local disks, where extra readers just contend
+%           - a single value fixes the number of readers
+%
+%       'Timeout' (=inf) <1x1 double>
+%           - seconds the crawl may take; once they are up, no more
+%             directories are opened, directories still being listed are
+%             abandoned, and whatever was found so far is returned
+%           - INFO.Unvisited lists the directories that were not searched so
+%             the search can be resumed from them later
+%           - requires the MEX code
+%
+%       'Progress' (=false) <1x1 logical or function_handle>
+%           - true prints running totals to the command window during the
+%             crawl; a function handle is instead called with a struct of
+%             Directories, Entries, Matches, Queued & ElapsedSeconds
+%           - a callback that errors is not called again
+%           - requires the MEX code
+%
+%       'ProgressInterval' (=1) <1x1 double>
+%           - seconds between progress reports
+%
+%       'MemoryLimit' (=inf) <1x1 double>
+%           - bytes of result paths the MEX code may hold in memory; beyond
+%             that, they are kept in a temporary file (and a requested 'Sort'
+%             is done as an external merge sort), so huge searches don't
+%             exhaust RAM before the outputs are created
+%           - the outputs themselves are not counted against the limit
+%           - requires the MEX code
+%
+%       'RespectIgnoreFiles' (=false) <1x1 logical>
+%           - skip anything ignored by .gitignore or .ignore files found while
+%             descending (using git's rules; .ignore takes precedence), and
+%             never descend into .git folders
+%           - ignored directories are never opened
+%           - requires the MEX code
+%
+%       'SameFilesystem' (=false) <1x1 logical>
+%           - do not descend into directories on a different device than
+%             PARENT_DIR (like "find -xdev"); mount points are still returned
+%           - requires the MEX code
+%
+%       'SkipPseudoFilesystems' (=true) <1x1 logical>
+%           - never descend into kernel or automounter filesystems such as
+%             /proc, /sys or autofs mounts (PARENT_DIR itself is always searched)
+%           - requires the MEX code
+%
 %       'Silent' (=false) <1x1 logical>
 %           - suppresses all warnings & print statements
 %
 %   Outputs:
 %
-%       FILES <Nx1 string>
+%       FILES <Nx1 string> or <1x1 struct>
 %           - the full filepaths that were matched
+%           - with 'Output','tree' this is instead a struct with fields:
+%
+%               Directory <Dx1 string>  each unique parent directory
+%               Parent    <Nx1 uint32>  index into Directory for each result
+%               Name      <Nx1 string>  the name of each result
+%               Type      <Nx1 fstype>  the type of each result
+%
+%             which takes far less memory for large, deep trees
+%           - with 'RawNames', this is instead a struct with fields:
+%
+%               Bytes       <Mx1 uint8>     every path, back-to-back
+%               Offsets     <(N+1)x1 double> path i is
+%                                           Bytes(Offsets(i)+1:Offsets(i+1))
+%               NameOffsets <Nx1 double>    name i is
+%                                           Bytes(NameOffsets(i)+1:Offsets(i+1))
+%
+%             and FILENAMES is the same struct
 %
 %       FILENAMES <Nx1 string>
 %           - the names of the files that were matched
@@ -60,6 +210,50 @@ function [files, filenames, types] = fsfind(parent_dir, pattern, opts)
 %             the MEX code is compiled; with no MEX, it will only return types
 %             "file" and "directory"
 %
+%       LINES <Nx1 double>
+%           - the line number of the first match when 'ContainsText' or
+%             'ContainsRegex' is used (NaN otherwise)
+%
+%       HASHES <Nx1 string>
+%           - lowercase hex digest of each regular file when 'Hash' is used
+%           - empty ("") for anything that is not a readable regular file
+%
+%       INFO <1x1 struct>
+%           - statistics about the search itself:
+%
+%               Directories     <double>  number of directories listed
+%               Entries         <double>  entries seen in them (before filtering)
+%               Concurrency     <double>  directories being read at once when
+%                                         the search finished
+%               ElapsedSeconds  <double>  time spent searching
+%               TimedOut        <logical> true if 'Timeout' cut the search short
+%               Unvisited       <Mx1 string> directories that were never (fully)
+%                                         listed because of the 'Timeout'
+%               UnvisitedDepth  <Mx1 double> the depth of each of them relative
+%                                         to its PARENT_DIR
+%               SpilledBytes    <double>  bytes written to temporary files to
+%                                         stay within the 'MemoryLimit'
+%
+%           - without the MEX code, only ElapsedSeconds is measured
+%
+%       ERRORS <table>
+%           - one row for everything the search could not read, sorted by
+%             path, instead of printing a message for each directory (which
+%             is slow when a tree has thousands of unreadable folders):
+%
+%               Path        <string>  the directory or entry
+%               Errno       <double>  the system error code (errno on unix)
+%               Operation   <string>  what failed: "opendir" or "readdir" for
+%                                     a directory, "stat" for an entry that
+%                                     could not be examined
+%
+%           - always empty without the MEX code
+%
+%       LINKS <Nx1 double>
+%           - the number of hard links to each result (0 for anything that
+%             could not be examined)
+%           - NaN without the MEX code
+%
 %   Notes:
 %
 %       This function can take advantage of C++ MEX via a support function,
@@ -67,6 +261,15 @@ function [files, filenames, types] = fsfind(parent_dir, pattern, opts)
 %       systems.  For Windows users the non-MEX codepath is usually preferred,
 %       but you can override and use the MEX version by running compile_mex_listfiles.
 %
+%       When the MEX code is used, the entire search runs in C++ and patterns
+%       are matched with std::regex (ECMAScript syntax).  This is the same as
+%       MATLAB's regexp syntax for all but the most exotic expressions.
+%
+%       Every PARENT_DIR is crawled at once by a pool of threads sharing one
+%       queue of directories; the results are still returned in the same order
+%       as a serial search.  Ctrl+C stops the search within a fraction of a
+%       second, including while file contents are being read or hashed.
+%
 %   Examples:
 %
 %       % get all files in the current directory
@@ -76,7 +279,17 @@ function [files, filenames, types] = fsfind(parent_dir, pattern, opts)
 %       % get all .m files up to 2 levels deep from current directory
 %       files = fsfind(pwd, "\.m$", 'Depth', 2)
 %
-%   See also: regexp, compile_mex_listfiles
+%       % search for at most 10 seconds, then pick up where we left off
+%       [files, ~, ~, ~, ~, info] = fsfind(pwd, 'Depth', inf, 'Timeout', 10);
+%       if info.TimedOut
+%           files = [files; fsfind(info.Unvisited, 'Depth', inf)];
+%       end
+%
+%       % list a huge tree compactly, then expand only the paths we need
+%       tree = fsfind(pwd, 'Depth', inf, 'Output', 'tree');
+%       paths = fsfind_expand(tree, find(tree.Type == "file"))
+%
+%   See also: regexp, fsfind_expand, fsfind_decode, compile_mex_listfiles
 
 %   Author:     Austin Fite
 %   Contact:    akfite@gmail.com
@@ -88,6 +301,26 @@ function [files, filenames, types] = fsfind(parent_dir, pattern, opts)
         opts.CaseSensitive(1,1) logical = true
         opts.Depth(1,1) double = 1
         opts.DepthwisePattern(:,1) string = string.empty
+        opts.Exclude(:,1) string = string.empty
+        opts.ExcludeDirs(:,1) string = string.empty
+        opts.ExcludeSyntax(1,:) char {mustBeMember(opts.ExcludeSyntax, {'glob','regex'})} = 'glob'
+        opts.ContainsText(1,1) string = ""
+        opts.ContainsRegex(1,1) string = ""
+        opts.Sort(1,:) char {mustBeMember(opts.Sort, {'none','path','name','natural','size','mtime'})} = 'none'
+        opts.RelativePaths(1,1) logical = false
+        opts.Output(1,:) char {mustBeMember(opts.Output, {'paths','tree'})} = 'paths'
+        opts.RawNames(1,1) logical = false
+        opts.UniqueInodes(1,1) logical = false
+        opts.Hash(1,:) char {mustBeMember(opts.Hash, {'none','xxh3','sha256'})} = 'none'
+        opts.Threads(1,1) double {mustBeInteger, mustBeNonnegative} = 0
+        opts.Concurrency(1,:) double {mustBeInteger, mustBePositive, mustBeNonempty} = [1 64]
+        opts.Timeout(1,1) double {mustBeNonnegative} = inf
+        opts.Progress(1,1) = false
+        opts.ProgressInterval(1,1) double {mustBePositive} = 1
+        opts.MemoryLimit(1,1) double {mustBePositive} = inf
+        opts.RespectIgnoreFiles(1,1) logical = false
+        opts.SameFilesystem(1,1) logical = false
+        opts.SkipPseudoFilesystems(1,1) logical = true
         opts.Silent(1,1) = false
     end
 
@@ -101,36 +334,235 @@ function [files, filenames, types] = fsfind(parent_dir, pattern, opts)
         end
     end
 
+    if opts.RawNames && strcmp(opts.Output, 'tree')
+        error('fsfind:bad_option', '''RawNames'' cannot be combined with ''Output'',''tree''');
+    end
+
     % depth must at least match the size of the guided search
     opts.Depth = max(opts.Depth, numel(opts.DepthwisePattern)+1);
 
-    files = string.empty;
-    filenames = string.empty;
-    types = fstype.empty;
+    if ~is_compiled && ~opts.Silent
+        if opts.SameFilesystem
+            warning('fsfind:requires_mex', ...
+                '''SameFilesystem'' requires mex_listfiles; searching across all filesystems');
+        end
+        if opts.RespectIgnoreFiles
+            warning('fsfind:requires_mex', ...
+                '''RespectIgnoreFiles'' requires mex_listfiles; ignore files will not be used');
+        end
+        if opts.UniqueInodes
+            warning('fsfind:requires_mex', ...
+                '''UniqueInodes'' requires mex_listfiles; hard-linked files may be returned more than once');
+        end
+        if ~strcmp(opts.Hash, 'none')
+            warning('fsfind:requires_mex', ...
+                '''Hash'' requires mex_listfiles; no hashes will be computed');
+        end
+        if isfinite(opts.Timeout)
+            warning('fsfind:requires_mex', ...
+                '''Timeout'' requires mex_listfiles; the search will run to completion');
+        end
+        if isa(opts.Progress, 'function_handle') || opts.Progress
+            warning('fsfind:requires_mex', ...
+                '''Progress'' requires mex_listfiles; no progress will be reported');
+        end
+        if isfinite(opts.MemoryLimit)
+            warning('fsfind:requires_mex', ...
+                '''MemoryLimit'' requires mex_listfiles; all results will be kept in memory');
+        end
+        if any(strcmp(opts.Sort, {'natural','size','mtime'}))
+            warning('fsfind:requires_mex', ...
+                '''Sort'',''%s'' requires mex_listfiles; results will not be sorted', opts.Sort);
+        end
+    end
 
+    % drop anything that isn't a directory
+    is_dir = true(size(parent_dir));
     for i = 1:numel(parent_dir)
-        if ~exist(parent_dir{i},'dir')
-            if ~opts.Silent
-                warning('fsfind:not_dir', '%s is not a directory; skipping...', parent_dir{i});
-            end
-            continue
+        is_dir(i) = exist(parent_dir{i},'dir') == 7;
+        if ~is_dir(i) && ~opts.Silent
+            warning('fsfind:not_dir', '%s is not a directory; skipping...', parent_dir{i});
         end
+    end
+    parent_dir = parent_dir(is_dir);
+
+    info = struct(...
+        'Directories', nan, ...
+        'Entries', nan, ...
+        'Concurrency', 1, ...
+        'ElapsedSeconds', 0, ...
+        'TimedOut', false, ...
+        'Unvisited', string.empty(0,1), ...
+        'UnvisitedDepth', zeros(0,1), ...
+        'SpilledBytes', 0);
+
+    errors = table(string.empty(0,1), zeros(0,1), string.empty(0,1), ...
+        'VariableNames', {'Path','Errno','Operation'});
+
+    fp = string.empty(0,1);
+    fn = string.empty(0,1);
+    type = uint8.empty(0,1);
+    ln = double.empty(0,1);
+    h = string.empty(0,1);
+    lk = double.empty(0,1);
+
+    if isempty(parent_dir)
+        % nothing to search
+    elseif is_compiled
+        % only ask for the outputs that are used (the rest are never computed)
+        n = max(nargout, 1);
+        if strcmp(opts.Output, 'tree')
+            n = max(n, 3);
+        end
+        out = {fp, fn, type, ln, h, info, errors, lk};
+        [out{1:n}] = native_search(parent_dir, pattern, opts);
+        [fp, fn, type, ln, h, info, errors, lk] = out{:};
+    else
+        t_start = tic;
+        [fp, fn, type, ln, h] = builtin_search(parent_dir, pattern, opts);
+        lk = nan(size(type));
+        info.ElapsedSeconds = toc(t_start);
+    end
 
-        [fp, fn, type] = search(parent_dir{i}, pattern, opts, is_compiled);
-
-        files = vertcat(files, fp); %#ok<*AGROW>
+    if strcmp(opts.Output, 'tree')
+        if ~isstruct(fp)
+            fp = to_tree(fp, fn);
+        end
 
-        if nargout > 1
-            filenames = vertcat(filenames, fn);
+        files = struct(...
+            'Directory', fp.Directory, ...
+            'Parent', fp.Parent, ...
+            'Name', fn, ...
+            'Type', fstype(type));
+    elseif opts.RawNames
+        if ~isstruct(fp)
+            fp = to_raw(fp, fn);
         end
-        if nargout > 2
-            types = vertcat(types, fstype(type));
+
+        files = fp;
+        fn = fp;
+    else
+        files = fp;
+    end
+
+    filenames = fn;
+    types = fstype(type);
+    lines = ln;
+    hashes = h;
+    links = lk;
+
+end
+
+function [filepaths, filenames, types, lines, hashes] = builtin_search(folders, pattern, opts)
+%BUILTIN_SEARCH Search every folder & post-process the results (non-MEX codepath).
+
+    filepaths = string.empty(0,1);
+    filenames = string.empty(0,1);
+    types = uint8.empty(0,1);
+    lines = double.empty(0,1);
+    from = double.empty(0,1);
+
+    for i = 1:numel(folders)
+        [fp, fn, type] = search(folders{i}, pattern, opts);
+        [fp, fn, type, ln] = filter_contents(fp, fn, type, opts);
+
+        filepaths = vertcat(filepaths, fp); %#ok<*AGROW>
+        filenames = vertcat(filenames, fn);
+        types = vertcat(types, type);
+        lines = vertcat(lines, ln);
+        from = vertcat(from, repmat(i, numel(fp), 1));
+    end
+
+    % overlapping folders find some paths more than once; keep the first
+    [~, order] = unique(filepaths, 'stable');
+
+    switch opts.Sort
+        case 'path'
+            [~, k] = sort(filepaths(order));
+            order = order(k);
+        case 'name'
+            [~, k] = sortrows([filenames(order), filepaths(order)]);
+            order = order(k);
+    end
+
+    filepaths = filepaths(order);
+    filenames = filenames(order);
+    types = types(order);
+    lines = lines(order);
+    from = from(order);
+    hashes = strings(size(filepaths));
+
+    if opts.RelativePaths
+        for i = 1:numel(folders)
+            mask = from == i;
+            filepaths(mask) = relative_to(filepaths(mask), folders{i});
         end
     end
+end
 
+function varargout = native_search(folders, pattern, opts)
+%NATIVE_SEARCH Run the entire search inside mex_listfiles (all folders at once).
+%   Outputs are the same as mex_listfiles; only those requested are made.
+
+    cfg = struct(...
+        'Pattern', char(pattern), ...
+        'CaseSensitive', opts.CaseSensitive, ...
+        'Depth', opts.Depth, ...
+        'DepthwisePattern', {cellstr(opts.DepthwisePattern)}, ...
+        'Exclude', {cellstr(opts.Exclude)}, ...
+        'ExcludeDirs', {cellstr(opts.ExcludeDirs)}, ...
+        'ExcludeSyntax', opts.ExcludeSyntax, ...
+        'ContainsText', char(opts.ContainsText), ...
+        'ContainsRegex', char(opts.ContainsRegex), ...
+        'Sort', opts.Sort, ...
+        'RelativePaths', opts.RelativePaths, ...
+        'Output', opts.Output, ...
+        'RawNames', opts.RawNames, ...
+        'UniqueInodes', opts.UniqueInodes, ...
+        'Hash', opts.Hash, ...
+        'Threads', opts.Threads, ...
+        'Concurrency', opts.Concurrency, ...
+        'Timeout', opts.Timeout, ...
+        'Progress', opts.Progress, ...
+        'ProgressInterval', opts.ProgressInterval, ...
+        'MemoryLimit', opts.MemoryLimit, ...
+        'RespectIgnoreFiles', opts.RespectIgnoreFiles, ...
+        'SameFilesystem', opts.SameFilesystem, ...
+        'SkipPseudoFilesystems', opts.SkipPseudoFilesystems, ...
+        'Silent', logical(opts.Silent));
+
+    % asking for the errors also stops them being printed
+    n = max(nargout, 1);
+    varargout = cell(1, n);
+    [varargout{:}] = mex_listfiles(cellstr(folders), cfg);
+
+    % raw names are left exactly as they are
+    if ~opts.RawNames
+        if isstruct(varargout{1})
+            varargout{1}.Directory = string(varargout{1}.Directory);
+        else
+            varargout{1} = string(varargout{1});
+        end
+        if n > 1
+            varargout{2} = string(varargout{2});
+        end
+    end
+    if n > 4
+        varargout{5} = string(varargout{5});
+    end
+    if n > 5
+        varargout{6}.Unvisited = string(varargout{6}.Unvisited);
+    end
+    if n > 6
+        errors = varargout{7};
+        errors.Path = string(errors.Path);
+        errors.Operation = string(errors.Operation);
+        varargout{7} = struct2table(errors);
+    end
 end
 
-function [all_filepaths, all_filenames, all_type] = search(folder, pattern, opts, is_compiled)
+function [all_filepaths, all_filenames, all_type] = search(folder, pattern, opts)
+%SEARCH Breadth-first search using the built-in dir() command (non-MEX codepath).
 
     separator = string(filesep);
 
@@ -154,6 +586,14 @@ function [all_filepaths, all_filenames, all_type] = search(folder, pattern, opts
         caseopt = {'ignorecase'};
     end
 
+    % translate wildcard excludes so both syntaxes can use regexp below
+    exclude = opts.Exclude;
+    exclude_dirs = opts.ExcludeDirs;
+    if strcmp(opts.ExcludeSyntax, 'glob')
+        exclude = "^" + regexptranslate('wildcard', exclude) + "$";
+        exclude_dirs = "^" + regexptranslate('wildcard', exclude_dirs) + "$";
+    end
+
     i_search = 0;
     depth = 1;
 
@@ -176,30 +616,27 @@ function [all_filepaths, all_filenames, all_type] = search(folder, pattern, opts
         end
         
         % get all of the contents of this folder (files, dirs, links, etc)
-        if is_compiled
-            % MEX codepath
-            try
-                [filepaths, filenames, type] = mex_listfiles(folder);
-            catch me
-                if ~opts.Silent
-                    if contains(me.message, 'permission', 'ignorecase', true)
-                        fprintf('Permission denied: %s\n', folder);
-                    else
-                        warning(me.identifier, ...
-                            '%s\nThis will prevent finding any results under %s', ...
-                            me.message, folder);
-                    end
-                end
-    
-                i_search = i_search + 1; continue
+        [filepaths, filenames, is_dir] = listfiles(folder);
+
+        % map is_dir into fstype enum (assuming all non-directories are files)
+        type = repmat(file_type, size(is_dir));
+        type(is_dir) = dir_type;
+
+        % drop excluded names before they can be searched
+        if ~isempty(exclude) || ~isempty(exclude_dirs)
+            mask = true(size(filenames));
+            for k = 1:numel(exclude)
+                mask = mask & cellfun('isempty', ...
+                    regexp(filenames, exclude{k}, 'once', caseopt{:}, 'forceCellOutput'));
             end
-        else
-            % non-MEX codepath
-            [filepaths, filenames, is_dir] = listfiles(folder);
-            
-            % map is_dir into fstype enum (assuming all non-directories are files)
-            type = repmat(file_type, size(is_dir));
-            type(is_dir) = dir_type;
+            for k = 1:numel(exclude_dirs)
+                mask = mask & (type ~= dir_type | cellfun('isempty', ...
+                    regexp(filenames, exclude_dirs{k}, 'once', caseopt{:}, 'forceCellOutput')));
+            end
+
+            filenames = filenames(mask);
+            filepaths = filepaths(mask);
+            type = type(mask);
         end
 
         file_depth = repmat(depth, numel(filenames), 1);
@@ -265,6 +702,88 @@ function [all_filepaths, all_filenames, all_type] = search(folder, pattern, opts
     end
 end
 
+function [filepaths, filenames, types, lines] = filter_contents(filepaths, filenames, types, opts)
+%FILTER_CONTENTS Keep only the regular files whose contents match (non-MEX codepath).
+
+    lines = nan(size(filepaths));
+
+    if strlength(opts.ContainsText) == 0 && strlength(opts.ContainsRegex) == 0
+        return
+    end
+
+    if strlength(opts.ContainsRegex) > 0
+        expr = opts.ContainsRegex;
+    else
+        expr = regexptranslate('escape', opts.ContainsText);
+    end
+
+    if opts.CaseSensitive
+        caseopt = {};
+    else
+        caseopt = {'ignorecase'};
+    end
+
+    for i = 1:numel(filepaths)
+        if types(i) ~= uint8(fstype.file)
+            continue
+        end
+
+        try
+            text = fileread(filepaths{i});
+        catch
+            continue
+        end
+
+        idx = regexp(text, expr, 'once', 'lineanchors', caseopt{:});
+        if ~isempty(idx)
+            lines(i) = nnz(text(1:idx-1) == newline) + 1;
+        end
+    end
+
+    mask = ~isnan(lines);
+    filepaths = filepaths(mask);
+    filenames = filenames(mask);
+    types = types(mask);
+    lines = lines(mask);
+end
+
+function filepaths = relative_to(filepaths, folder)
+%RELATIVE_TO Strip the search root from each path (non-MEX codepath).
+
+    % search() builds paths from the folder without its trailing fileseps
+    while endsWith(folder, filesep)
+        folder = extractBefore(folder, strlength(folder));
+    end
+
+    filepaths = extractAfter(filepaths, strlength(folder) + 1);
+end
+
+function raw = to_raw(filepaths, filenames)
+%TO_RAW Pack paths into the 'RawNames' struct (non-MEX codepath).
+
+    bytes = arrayfun(@(p) unicode2native(char(p), 'UTF-8'), filepaths, 'UniformOutput', false);
+    name_lengths = arrayfun(@(n) numel(unicode2native(char(n), 'UTF-8')), filenames);
+    lengths = cellfun(@numel, bytes);
+    offsets = [0; cumsum(lengths(:))];
+
+    raw = struct(...
+        'Bytes', reshape(horzcat(zeros(1,0,'uint8'), bytes{:}), [], 1), ...
+        'Offsets', offsets, ...
+        'NameOffsets', offsets(2:end) - name_lengths(:));
+end
+
+function tree = to_tree(filepaths, filenames)
+%TO_TREE Split full paths into unique directories & an index into them (non-MEX codepath).
+
+    % every path is built as folder + filesep + name (or just name when relative)
+    n = strlength(filepaths) - strlength(filenames);
+    dirs = extractBefore(filepaths, max(n, 1));
+    dirs(n == 1) = filesep;
+
+    [tree.Directory, ~, parent] = unique(dirs, 'stable');
+    tree.Parent = uint32(parent);
+end
+
 function [filepaths, filenames, is_directory] = listfiles(folder)
 %LISTFILES Get the contents of the folder without using MEX.
 
@@ -0,0 +1,69 @@
+function names = fsfind_decode(raw, rows, opts)
+%FSFIND_DECODE Strings from the raw path bytes returned by fsfind.
+%
+%   Usage:
+%
+%       NAMES = FSFIND_DECODE(RAW)
+%       NAMES = FSFIND_DECODE(RAW, ROWS)
+%       NAMES = FSFIND_DECODE(RAW, ROWS, options...)
+%
+%
+%   Inputs:
+%
+%       RAW <1x1 struct>
+%           - the output of fsfind(..., 'RawNames', true)
+%
+%       ROWS <Nx1 integer or logical>
+%           - the entries to decode (default: all of them)
+%
+%   Inputs (optional param-value pairs):
+%
+%       'Part' (="path") <1x1 string>
+%           - "path" for the full path of each entry, "name" for its name only
+%
+%       'Encoding' (="UTF-8") <1x1 string>
+%           - the encoding of the bytes, e.g. "ISO-8859-1" for Latin-1 names
+%           - anything accepted by native2unicode
+%
+%   Outputs:
+%
+%       NAMES <Nx1 string>
+%           - the decoded path (or name) of each selected entry
+%
+%   Examples:
+%
+%       raw = fsfind('/mnt/legacy', 'Depth', inf, 'RawNames', true);
+%
+%       % the names of the first 10 entries, which were written as Latin-1
+%       names = fsfind_decode(raw, 1:10, 'Part', "name", 'Encoding', "ISO-8859-1")
+%
+%   See also: fsfind
+
+%   Author:     Austin Fite
+%   Contact:    akfite@gmail.com
+%   Date:       2024
+
+    arguments
+        raw(1,1) struct
+        rows(:,1) = (1:numel(raw.NameOffsets))'
+        opts.Part(1,1) string {mustBeMember(opts.Part, ["path","name"])} = "path"
+        opts.Encoding(1,1) string = "UTF-8"
+    end
+
+    if islogical(rows)
+        rows = find(rows);
+    end
+
+    if opts.Part == "name"
+        first = raw.NameOffsets(rows) + 1;
+    else
+        first = raw.Offsets(rows) + 1;
+    end
+    last = raw.Offsets(rows + 1);
+
+    names = strings(numel(rows), 1);
+    for i = 1:numel(rows)
+        names(i) = native2unicode(reshape(raw.Bytes(first(i):last(i)), 1, []), char(opts.Encoding));
+    end
+
+end
@@ -0,0 +1,107 @@
+function usage = fsfind_du(parent_dir, pattern, opts)
+%FSFIND_DU Disk usage of each directory in a tree (like the "du" command).
+%
+%   Usage:
+%
+%       USAGE = FSFIND_DU()
+%       USAGE = FSFIND_DU(PARENT_DIR)
+%       USAGE = FSFIND_DU(PARENT_DIR, PATTERN)
+%       USAGE = FSFIND_DU(PARENT_DIR, PATTERN, options...)
+%
+%
+%   Inputs:
+%
+%       PARENT_DIR <1x1 string>
+%           - the directory to measure
+%
+%       PATTERN <1x1 string>
+%           - only entries whose names match this regular expression are
+%             counted (e.g. "\.h5$" for the space used by HDF5 files)
+%
+%   Inputs (optional param-value pairs):
+%
+%       'ReportDepth' (=1) <1x1 integer>
+%           - directories up to this depth below PARENT_DIR get their own row;
+%             everything deeper is rolled up into its ancestor at this depth
+%
+%       'Depth' (=inf) <1x1 integer>
+%           - the maximum search depth relative to PARENT_DIR
+%
+%       'CaseSensitive', 'DepthwisePattern', 'Exclude', 'ExcludeDirs',
+%       'ExcludeSyntax', 'RespectIgnoreFiles', 'SameFilesystem',
+%       'SkipPseudoFilesystems', 'Concurrency', 'Silent'
+%           - same as fsfind
+%
+%   Outputs:
+%
+%       USAGE <table>
+%           - one row per directory (PARENT_DIR first, at depth 0) with
+%             the totals for everything beneath it:
+%
+%               Path            <string>  the directory
+%               Depth           <double>  depth relative to PARENT_DIR
+%               Files           <double>  number of non-directory entries
+%               Directories     <double>  number of subdirectories
+%               ApparentBytes   <double>  sum of file sizes
+%               AllocatedBytes  <double>  space actually used on disk
+%
+%   Notes:
+%
+%       Sizes are totalled in the MEX code while crawling, so no per-file
+%       results are ever created.  Files with several hard links inside the
+%       tree are only counted once.  Like fsfind, symbolic links are followed.
+%
+%   See also: fsfind
+
+%   Author:     Austin Fite
+%   Contact:    akfite@gmail.com
+%   Date:       2024
+
+    arguments
+        parent_dir(1,1) string = pwd
+        pattern(1,1) string = ".*"
+        opts.ReportDepth(1,1) double {mustBeNonnegative} = 1
+        opts.CaseSensitive(1,1) logical = true
+        opts.Depth(1,1) double = inf
+        opts.DepthwisePattern(:,1) string = string.empty
+        opts.Exclude(:,1) string = string.empty
+        opts.ExcludeDirs(:,1) string = string.empty
+        opts.ExcludeSyntax(1,:) char {mustBeMember(opts.ExcludeSyntax, {'glob','regex'})} = 'glob'
+        opts.RespectIgnoreFiles(1,1) logical = false
+        opts.SameFilesystem(1,1) logical = false
+        opts.SkipPseudoFilesystems(1,1) logical = true
+        opts.Concurrency(1,:) double {mustBeInteger, mustBePositive, mustBeNonempty} = [1 64]
+        opts.Silent(1,1) = false
+    end
+
+    if exist(['mex_listfiles.' mexext], 'file') == 0
+        error('fsfind:requires_mex', ...
+            'fsfind_du requires mex_listfiles (run compile_mex_listfiles)');
+    end
+
+    if ~exist(parent_dir, 'dir')
+        error('fsfind:not_dir', '%s is not a directory', parent_dir);
+    end
+
+    cfg = struct(...
+        'Mode', 'du', ...
+        'Pattern', char(pattern), ...
+        'CaseSensitive', opts.CaseSensitive, ...
+        'Depth', max(opts.Depth, numel(opts.DepthwisePattern)+1), ...
+        'DepthwisePattern', {cellstr(opts.DepthwisePattern)}, ...
+        'Exclude', {cellstr(opts.Exclude)}, ...
+        'ExcludeDirs', {cellstr(opts.ExcludeDirs)}, ...
+        'ExcludeSyntax', opts.ExcludeSyntax, ...
+        'RespectIgnoreFiles', opts.RespectIgnoreFiles, ...
+        'SameFilesystem', opts.SameFilesystem, ...
+        'SkipPseudoFilesystems', opts.SkipPseudoFilesystems, ...
+        'ReportDepth', opts.ReportDepth, ...
+        'Concurrency', opts.Concurrency, ...
+        'Silent', logical(opts.Silent));
+
+    s = mex_listfiles(char(parent_dir), cfg);
+    s.Path = string(s.Path);
+
+    usage = struct2table(s);
+
+end
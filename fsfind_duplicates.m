@@ -0,0 +1,112 @@
+function [groups, hardlinks] = fsfind_duplicates(parent_dir, pattern, opts)
+%FSFIND_DUPLICATES Find regular files with identical contents.
+%
+%   Usage:
+%
+%       GROUPS = FSFIND_DUPLICATES()
+%       GROUPS = FSFIND_DUPLICATES(PARENT_DIR)
+%       GROUPS = FSFIND_DUPLICATES(PARENT_DIR, PATTERN)
+%       GROUPS = FSFIND_DUPLICATES(PARENT_DIR, PATTERN, options...)
+%       [GROUPS, HARDLINKS] = FSFIND_DUPLICATES(_____)
+%
+%
+%   Inputs:
+%
+%       PARENT_DIR <Nx1 string>
+%           - one or more directories to search; files are compared across
+%             all of them, and anything found twice (when one directory is
+%             inside another) is only considered once
+%
+%       PATTERN <1x1 string>
+%           - only files whose names match this regular expression are compared
+%
+%   Inputs (optional param-value pairs):
+%
+%       'MinSize' (=1) <1x1 double>
+%           - files smaller than this many bytes are ignored (by default, empty
+%             files are not reported as duplicates of each other)
+%
+%       'Depth' (=inf) <1x1 integer>
+%           - the maximum search depth relative to PARENT_DIR
+%
+%       'CaseSensitive', 'DepthwisePattern', 'Exclude', 'ExcludeDirs',
+%       'ExcludeSyntax', 'RespectIgnoreFiles', 'SameFilesystem',
+%       'SkipPseudoFilesystems', 'Threads', 'Concurrency', 'Silent'
+%           - same as fsfind
+%
+%   Outputs:
+%
+%       GROUPS <Mx1 cell of Nx1 string>
+%           - each cell holds the paths of files with identical contents
+%           - files that are hard links to each other are only listed once
+%             (by the first path found), since they are the same data
+%
+%       HARDLINKS <Kx1 cell of Nx1 string>
+%           - each cell holds every path found to a single hard-linked file
+%           - these are detected from the device & inode alone (never read)
+%
+%   Notes:
+%
+%       Files are compared in stages so that as little data as possible is
+%       read: first by size, then by a hash of their first & last 64 KiB,
+%       and only then by a hash of the entire file.  All hashing is done on
+%       a pool of worker threads in the MEX code, which is required.
+%
+%   See also: fsfind
+
+%   Author:     Austin Fite
+%   Contact:    akfite@gmail.com
+%   Date:       2024
+
+    arguments
+        parent_dir(:,1) string = pwd
+        pattern(1,1) string = ".*"
+        opts.MinSize(1,1) double {mustBeNonnegative} = 1
+        opts.CaseSensitive(1,1) logical = true
+        opts.Depth(1,1) double = inf
+        opts.DepthwisePattern(:,1) string = string.empty
+        opts.Exclude(:,1) string = string.empty
+        opts.ExcludeDirs(:,1) string = string.empty
+        opts.ExcludeSyntax(1,:) char {mustBeMember(opts.ExcludeSyntax, {'glob','regex'})} = 'glob'
+        opts.RespectIgnoreFiles(1,1) logical = false
+        opts.SameFilesystem(1,1) logical = false
+        opts.SkipPseudoFilesystems(1,1) logical = true
+        opts.Threads(1,1) double {mustBeInteger, mustBeNonnegative} = 0
+        opts.Concurrency(1,:) double {mustBeInteger, mustBePositive, mustBeNonempty} = [1 64]
+        opts.Silent(1,1) = false
+    end
+
+    if exist(['mex_listfiles.' mexext], 'file') == 0
+        error('fsfind:requires_mex', ...
+            'fsfind_duplicates requires mex_listfiles (run compile_mex_listfiles)');
+    end
+
+    for i = 1:numel(parent_dir)
+        if ~exist(parent_dir(i), 'dir')
+            error('fsfind:not_dir', '%s is not a directory', parent_dir(i));
+        end
+    end
+
+    cfg = struct(...
+        'Mode', 'duplicates', ...
+        'Pattern', char(pattern), ...
+        'CaseSensitive', opts.CaseSensitive, ...
+        'Depth', max(opts.Depth, numel(opts.DepthwisePattern)+1), ...
+        'DepthwisePattern', {cellstr(opts.DepthwisePattern)}, ...
+        'Exclude', {cellstr(opts.Exclude)}, ...
+        'ExcludeDirs', {cellstr(opts.ExcludeDirs)}, ...
+        'ExcludeSyntax', opts.ExcludeSyntax, ...
+        'RespectIgnoreFiles', opts.RespectIgnoreFiles, ...
+        'SameFilesystem', opts.SameFilesystem, ...
+        'SkipPseudoFilesystems', opts.SkipPseudoFilesystems, ...
+        'MinSize', opts.MinSize, ...
+        'Threads', opts.Threads, ...
+        'Concurrency', opts.Concurrency, ...
+        'Silent', logical(opts.Silent));
+
+    [groups, hardlinks] = mex_listfiles(cellstr(parent_dir), cfg);
+
+    groups = cellfun(@string, groups, 'UniformOutput', false);
+    hardlinks = cellfun(@string, hardlinks, 'UniformOutput', false);
+
+end
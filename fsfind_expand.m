@@ -0,0 +1,53 @@
+function paths = fsfind_expand(tree, rows)
+%FSFIND_EXPAND Full paths of entries in a tree returned by fsfind.
+%
+%   Usage:
+%
+%       PATHS = FSFIND_EXPAND(TREE)
+%       PATHS = FSFIND_EXPAND(TREE, ROWS)
+%
+%
+%   Inputs:
+%
+%       TREE <1x1 struct>
+%           - the output of fsfind(..., 'Output', 'tree')
+%
+%       ROWS <Nx1 integer or logical>
+%           - the entries to expand (default: all of them)
+%
+%   Outputs:
+%
+%       PATHS <Nx1 string>
+%           - the full path of each selected entry, exactly as fsfind would
+%             have returned it with 'Output','paths' (relative to the
+%             search root if 'RelativePaths' was used)
+%
+%   Examples:
+%
+%       tree = fsfind(pwd, 'Depth', inf, 'Output', 'tree');
+%
+%       % paths of every .m file, without ever building the full list
+%       paths = fsfind_expand(tree, endsWith(tree.Name, ".m"))
+%
+%   See also: fsfind
+
+%   Author:     Austin Fite
+%   Contact:    akfite@gmail.com
+%   Date:       2024
+
+    arguments
+        tree(1,1) struct
+        rows(:,1) = (1:numel(tree.Name))'
+    end
+
+    dirs = reshape(tree.Directory(tree.Parent(rows)), [], 1);
+    names = reshape(tree.Name(rows), [], 1);
+
+    paths = dirs + filesep + names;
+
+    % the root of the filesystem already ends with a separator, and with
+    % 'RelativePaths' the search root itself is ""
+    no_separator = endsWith(dirs, ["/", filesep]) | dirs == "";
+    paths(no_separator) = dirs(no_separator) + names(no_separator);
+
+end
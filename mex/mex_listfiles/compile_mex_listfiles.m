@@ -60,8 +60,8 @@ function [ok, msg] = compile_mex_listfiles(cmd)
                     CXXFLAGS = {'CXXFLAGS="-std=c++17"'};
                 end
 
-                % compile
-                mex(MEXOPTS{:}, CXXFLAGS{:}, 'mex_listfiles.cpp');
+                % compile (libut provides utIsInterruptPending for Ctrl+C)
+                mex(MEXOPTS{:}, CXXFLAGS{:}, 'mex_listfiles.cpp', 'fsfind_engine.cpp', '-lut');
 
             catch err
                 ok = false;
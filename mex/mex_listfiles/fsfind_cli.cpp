@@ -0,0 +1,515 @@
+//   Description: fsfind from the command line.  Takes the same options as the
+//                MATLAB function (e.g. --Depth inf --ExcludeDirs .git), and
+//                prints one path per line (or NUL-separated with -0).
+//
+//                g++ -std=c++17 -O2 -pthread fsfind_cli.cpp fsfind_engine.cpp -o fsfind
+//
+//   Author:     Austin Fite
+//   Contact:    akfite@gmail.com
+//   Date:       2024
+
+#include "fsfind_engine.h"
+
+#include <csignal>
+#include <cstdlib>
+#include <stdexcept>
+
+constexpr const char* USAGE =
+    "usage: fsfind [options] [PATTERN [DIR...]]\n"
+    "\n"
+    "Lists everything under each DIR (default: .) whose name matches the regular\n"
+    "expression PATTERN (default: .*).  Options are the same as the MATLAB function:\n"
+    "\n"
+    "  --Mode list|duplicates|du      what to report (duplicates & du search at any depth)\n"
+    "  --CaseSensitive true|false\n"
+    "  --Depth N                      inf for no limit (default: 1)\n"
+    "  --DepthwisePattern REGEX       once per depth, in order\n"
+    "  --Exclude GLOB                 may be repeated\n"
+    "  --ExcludeDirs GLOB             may be repeated\n"
+    "  --ExcludeSyntax glob|regex\n"
+    "  --ContainsText TEXT\n"
+    "  --ContainsRegex REGEX\n"
+    "  --Sort none|path|name|natural|size|mtime\n"
+    "  --RelativePaths true|false\n"
+    "  --UniqueInodes true|false      list each hard-linked file once\n"
+    "  --Hash none|xxh3|sha256        prints \"HASH  PATH\"\n"
+    "  --Threads N\n"
+    "  --Concurrency N|MIN,MAX\n"
+    "  --Timeout SECONDS\n"
+    "  --Progress true|false          reported on stderr\n"
+    "  --ProgressInterval SECONDS\n"
+    "  --MemoryLimit BYTES\n"
+    "  --RespectIgnoreFiles true|false\n"
+    "  --SameFilesystem true|false\n"
+    "  --SkipPseudoFilesystems true|false\n"
+    "  --MinSize BYTES                smallest file compared (duplicates mode)\n"
+    "  --ReportDepth N                deepest directory reported (du mode)\n"
+    "  --Silent true|false            don't report problems on stderr\n"
+    "  -0, --print0                   separate the output with NUL instead of newline\n"
+    "  -h, --help\n";
+
+volatile std::sig_atomic_t interrupt_flag = 0;
+
+extern "C" void on_interrupt(int)
+{
+    interrupt_flag = 1;
+}
+
+// thrown for anything wrong with the command line
+struct usage_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+inline bool iequals(const std::string& a, const char* b)
+{
+    if (a.size() != std::strlen(b))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool parse_logical(const std::string& name, const std::string& value)
+{
+    if (iequals(value, "true") || value == "1")
+    {
+        return true;
+    }
+    if (iequals(value, "false") || value == "0")
+    {
+        return false;
+    }
+    throw usage_error("option '" + name + "' must be true or false");
+}
+
+inline double parse_double(const std::string& name, const std::string& value)
+{
+    try
+    {
+        size_t used = 0;
+        const double out = std::stod(value, &used);
+        if (used == value.size())
+        {
+            return out;
+        }
+    }
+    catch (const std::logic_error&)
+    {
+    }
+    throw usage_error("option '" + name + "' must be a number");
+}
+
+// one of "choices", as an index into them
+inline size_t parse_choice(const std::string& name, const std::string& value, std::initializer_list<const char*> choices)
+{
+    size_t i = 0;
+    for (const char* choice : choices)
+    {
+        if (value == choice)
+        {
+            return i;
+        }
+        i++;
+    }
+    throw usage_error("unknown " + name + " '" + value + "'");
+}
+
+struct cli_options
+{
+    search_options search;
+    std::vector<fs::path> roots;
+    char delimiter = '\n';
+    bool depth_given = false;
+};
+
+inline cli_options parse_command_line(int argc, char** argv)
+{
+    cli_options out;
+    search_options& opts = out.search;
+    std::vector<std::string> positional;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "-0" || arg == "--print0")
+        {
+            out.delimiter = '\0';
+            continue;
+        }
+        if (arg == "-h" || arg == "--help")
+        {
+            std::fputs(USAGE, stdout);
+            std::exit(0);
+        }
+        if (arg == "--")
+        {
+            positional.insert(positional.end(), argv + i + 1, argv + argc);
+            break;
+        }
+        if (arg.size() < 3 || arg.compare(0, 2, "--") != 0)
+        {
+            positional.push_back(arg);
+            continue;
+        }
+
+        const std::string name = arg.substr(2);
+        if (i + 1 >= argc)
+        {
+            throw usage_error("option '" + name + "' needs a value");
+        }
+        const std::string value = argv[++i];
+
+        if (iequals(name, "Mode"))
+        {
+            opts.mode = static_cast<search_mode>(parse_choice(name, value, {"list", "duplicates", "du"}));
+        }
+        else if (iequals(name, "CaseSensitive"))
+        {
+            opts.case_sensitive = parse_logical(name, value);
+        }
+        else if (iequals(name, "Depth"))
+        {
+            opts.depth = parse_double(name, value);
+            out.depth_given = true;
+        }
+        else if (iequals(name, "DepthwisePattern"))
+        {
+            opts.depthwise_pattern.push_back(value);
+        }
+        else if (iequals(name, "Exclude"))
+        {
+            opts.exclude.push_back(value);
+        }
+        else if (iequals(name, "ExcludeDirs"))
+        {
+            opts.exclude_dirs.push_back(value);
+        }
+        else if (iequals(name, "ExcludeSyntax"))
+        {
+            opts.exclude_regex = parse_choice(name, value, {"glob", "regex"}) == 1;
+        }
+        else if (iequals(name, "ContainsText"))
+        {
+            opts.contains_text = value;
+        }
+        else if (iequals(name, "ContainsRegex"))
+        {
+            opts.contains_regex = value;
+        }
+        else if (iequals(name, "Sort"))
+        {
+            opts.sort = static_cast<sort_key>(parse_choice(name, value,
+                {"none", "name", "path", "natural", "size", "mtime"}));
+        }
+        else if (iequals(name, "RelativePaths"))
+        {
+            opts.relative_paths = parse_logical(name, value);
+        }
+        else if (iequals(name, "UniqueInodes"))
+        {
+            opts.unique_inodes = parse_logical(name, value);
+        }
+        else if (iequals(name, "Hash"))
+        {
+            opts.hash = static_cast<hash_kind>(parse_choice(name, value, {"none", "xxh3", "sha256"}));
+        }
+        else if (iequals(name, "Threads"))
+        {
+            opts.threads = parse_double(name, value);
+        }
+        else if (iequals(name, "Concurrency"))
+        {
+            // N, or MIN,MAX
+            const size_t comma = value.find(',');
+            const double lo = parse_double(name, value.substr(0, comma));
+            const double hi = (comma == std::string::npos) ? lo : parse_double(name, value.substr(comma + 1));
+            // (inf or nan can't be converted to a count)
+            if (!std::isfinite(lo) || !std::isfinite(hi) || lo < 1 || hi < lo)
+            {
+                throw usage_error("option 'Concurrency' must be N or MIN,MAX with finite 1 <= MIN <= MAX");
+            }
+            opts.min_concurrency = static_cast<size_t>(lo);
+            opts.max_concurrency = static_cast<size_t>(hi);
+        }
+        else if (iequals(name, "Timeout"))
+        {
+            opts.timeout = parse_double(name, value);
+        }
+        else if (iequals(name, "Progress"))
+        {
+            if (parse_logical(name, value))
+            {
+                opts.progress = [](const search_progress& progress)
+                {
+                    std::fprintf(stderr, "fsfind: %llu directories, %llu entries, %llu matches, %llu queued (%.1f s)\n",
+                        static_cast<unsigned long long>(progress.directories),
+                        static_cast<unsigned long long>(progress.entries),
+                        static_cast<unsigned long long>(progress.matches),
+                        static_cast<unsigned long long>(progress.queued), progress.elapsed);
+                    return true;
+                };
+            }
+            else
+            {
+                opts.progress = nullptr;
+            }
+        }
+        else if (iequals(name, "ProgressInterval"))
+        {
+            opts.progress_interval = parse_double(name, value);
+        }
+        else if (iequals(name, "MemoryLimit"))
+        {
+            opts.memory_limit = parse_double(name, value);
+        }
+        else if (iequals(name, "RespectIgnoreFiles"))
+        {
+            opts.respect_ignore_files = parse_logical(name, value);
+        }
+        else if (iequals(name, "SameFilesystem"))
+        {
+            opts.same_filesystem = parse_logical(name, value);
+        }
+        else if (iequals(name, "SkipPseudoFilesystems"))
+        {
+            opts.skip_pseudo_filesystems = parse_logical(name, value);
+        }
+        else if (iequals(name, "MinSize"))
+        {
+            opts.min_size = static_cast<uint64_t>(std::max(0.0, parse_double(name, value)));
+        }
+        else if (iequals(name, "ReportDepth"))
+        {
+            opts.report_depth = parse_double(name, value);
+        }
+        else if (iequals(name, "Silent"))
+        {
+            opts.silent = parse_logical(name, value);
+        }
+        else
+        {
+            throw usage_error("unknown option '" + name + "'");
+        }
+    }
+
+    if (!positional.empty())
+    {
+        opts.pattern = positional[0];
+    }
+    for (size_t i = 1; i < positional.size(); i++)
+    {
+        out.roots.emplace_back(positional[i]);
+    }
+    if (out.roots.empty())
+    {
+        out.roots.emplace_back(".");
+    }
+
+    // like fsfind_duplicates & fsfind_du, those modes search the whole tree
+    // unless told otherwise
+    if (opts.mode == search_mode::duplicates)
+    {
+        opts.collect_stats = true;
+        if (!out.depth_given)
+        {
+            opts.depth = std::numeric_limits<double>::infinity();
+        }
+        if (opts.min_size == 0)
+        {
+            opts.min_size = 1;
+        }
+    }
+    else if (opts.mode == search_mode::disk_usage && !out.depth_given)
+    {
+        opts.depth = std::numeric_limits<double>::infinity();
+    }
+    if (opts.sort == sort_key::size || opts.sort == sort_key::mtime)
+    {
+        opts.collect_stats = true;
+    }
+
+    // only paths (and hashes or sizes) are printed, never the type of an entry,
+    // so plain files aren't stat'd unless another option needs them to be
+    opts.need_types = false;
+
+    // depth must at least match the size of the guided search
+    opts.depth = std::max(opts.depth, static_cast<double>(opts.depthwise_pattern.size() + 1));
+
+    opts.interrupted = []()
+    {
+        return interrupt_flag != 0;
+    };
+    return out;
+}
+
+// buffered writes of whole records to stdout
+class output
+{
+public:
+    explicit output(char delimiter)
+        : delimiter_(delimiter)
+    {
+    }
+
+    ~output()
+    {
+        flush();
+    }
+
+    output& operator<<(std::string_view text)
+    {
+        buffer_.append(text.data(), text.size());
+        if (buffer_.size() >= (1 << 16))
+        {
+            flush();
+        }
+        return *this;
+    }
+
+    void end_record()
+    {
+        buffer_.push_back(delimiter_);
+    }
+
+    void flush()
+    {
+        std::fwrite(buffer_.data(), 1, buffer_.size(), stdout);
+        buffer_.clear();
+    }
+
+private:
+    std::string buffer_;
+    char delimiter_;
+};
+
+// problems go to stderr; returns true if anything was left unsearched
+inline bool report_problems(const search_results& results, const search_options& opts)
+{
+    bool incomplete = false;
+    for (const search_error& err : results.errors)
+    {
+        // entries that could not be examined were never reported
+        if (std::strcmp(err.operation, "stat") == 0)
+        {
+            continue;
+        }
+
+        incomplete = true;
+        if (!opts.silent)
+        {
+            std::fprintf(stderr, "fsfind: %s: %s\n", err.path.c_str(), err.ec.message().c_str());
+        }
+    }
+
+    if (!results.unvisited.empty())
+    {
+        incomplete = true;
+        if (!opts.silent)
+        {
+            std::fprintf(stderr, "fsfind: timed out; %zu directories were not searched\n", results.unvisited.size());
+        }
+    }
+
+    if (results.stats.spill_failed && !opts.silent)
+    {
+        std::fprintf(stderr, "fsfind: a temporary file could not be used, so 'MemoryLimit' was exceeded\n");
+    }
+    return incomplete;
+}
+
+inline void print_groups(output& out, const search_results& results, const std::vector<std::vector<size_t>>& groups)
+{
+    // each group ends with an empty record
+    for (const auto& group : groups)
+    {
+        for (size_t i : group)
+        {
+            out << results.output_path(i);
+            out.end_record();
+        }
+        out.end_record();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    cli_options cli;
+    try
+    {
+        cli = parse_command_line(argc, argv);
+    }
+    catch (const usage_error& err)
+    {
+        std::fprintf(stderr, "fsfind: %s\n\n%s", err.what(), USAGE);
+        return 2;
+    }
+
+    const search_options& opts = cli.search;
+    std::signal(SIGINT, on_interrupt);
+
+    search_results results;
+    try
+    {
+        results = search(cli.roots, opts);
+    }
+    catch (const std::regex_error& err)
+    {
+        std::fprintf(stderr, "fsfind: invalid regular expression: %s\n", err.what());
+        return 2;
+    }
+    catch (const std::invalid_argument& err)
+    {
+        std::fprintf(stderr, "fsfind: %s\n", err.what());
+        return 2;
+    }
+
+    if (results.stats.interrupted)
+    {
+        return 130;
+    }
+
+    const bool incomplete = report_problems(results, opts);
+
+    output out(cli.delimiter);
+    if (opts.mode == search_mode::duplicates)
+    {
+        const duplicate_groups groups = find_duplicates(results, opts);
+        if (groups.interrupted)
+        {
+            return 130;
+        }
+        print_groups(out, results, groups.duplicates);
+    }
+    else if (opts.mode == search_mode::disk_usage)
+    {
+        // like du: allocated bytes, then the directory
+        for (const usage_node& node : results.usage)
+        {
+            out << std::to_string(node.allocated) << "\t" << node.path;
+            out.end_record();
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            if (!results.hashes.empty() && !results.hashes[i].empty())
+            {
+                out << results.hashes[i] << "  ";
+            }
+            out << results.output_path(i);
+            out.end_record();
+        }
+    }
+    out.flush();
+
+    return incomplete ? 1 : 0;
+}
@@ -0,0 +1,3455 @@
+// the search engine behind fsfind (see fsfind_engine.h)
+//
+// Author:     Austin Fite
+// Contact:    akfite@gmail.com
+// Date:       2024
+
+#include "fsfind_engine.h"
+
+#include <stdexcept>
+
+#if FSFIND_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/vfs.h>
+#else
+#include <sys/mount.h>
+#endif
+#endif
+
+// lightweight replacement for MATLAB's "dir"
+std::list<fs::path> get_contents(std::string folder, std::error_code& ec)
+{
+    std::list<fs::path> files;
+    fs::directory_iterator it(folder, ec);
+    for (; !ec && it != fs::directory_iterator(); it.increment(ec))
+    {
+        files.emplace_back(it->path());
+    }
+    return files;
+}
+
+uint8_t uint8_filetype(fs::file_type type)
+{
+    switch (type)
+    {
+        case fs::file_type::regular:
+            return 2;
+        case fs::file_type::directory:
+            return 3;
+        case fs::file_type::symlink:
+            return 4;
+        case fs::file_type::block:
+            return 5;
+        case fs::file_type::character:
+            return 6;
+        case fs::file_type::fifo:
+            return 7;
+        case fs::file_type::socket:
+            return 8;
+        case fs::file_type::unknown:
+            return 9;
+        case fs::file_type::none:
+            return 0;
+        case fs::file_type::not_found:
+            return 1;
+        default:
+            return 9;
+    }
+}
+
+uint8_t uint8_filetype(const fs::path& p)
+{
+    std::error_code ec;
+    return uint8_filetype(fs::status(p, ec).type());
+}
+
+// the file type & device of a single path (follows symlinks, like fs::status)
+struct file_info
+{
+    uint8_t type = 0;
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+    uint64_t size = 0;
+    uint64_t allocated = 0;     // bytes actually used on disk
+    uint64_t nlink = 1;
+    int64_t mtime = 0;          // nanoseconds since the epoch
+    int error = 0;              // why it could not be examined (but not if it's just missing)
+};
+
+#if FSFIND_POSIX
+inline uint8_t uint8_filetype(mode_t mode)
+{
+    if (S_ISREG(mode))  return 2;
+    if (S_ISDIR(mode))  return 3;
+    if (S_ISLNK(mode))  return 4;
+    if (S_ISBLK(mode))  return 5;
+    if (S_ISCHR(mode))  return 6;
+    if (S_ISFIFO(mode)) return 7;
+    if (S_ISSOCK(mode)) return 8;
+    return 9;
+}
+#endif
+
+// a single stat() gives us both the type and the device, so checking for mount
+// boundaries costs nothing extra on POSIX systems
+inline file_info get_file_info(const fs::path& p)
+{
+    file_info info;
+#if FSFIND_POSIX
+    struct stat st;
+    if (::stat(p.c_str(), &st) == 0)
+    {
+        info.type = uint8_filetype(st.st_mode);
+        info.dev = static_cast<uint64_t>(st.st_dev);
+        info.ino = static_cast<uint64_t>(st.st_ino);
+        info.size = static_cast<uint64_t>(st.st_size);
+        info.allocated = static_cast<uint64_t>(st.st_blocks) * 512;
+        info.nlink = static_cast<uint64_t>(st.st_nlink);
+#if defined(__APPLE__)
+        info.mtime = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+        info.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    }
+    else if (errno == ENOENT || errno == ENOTDIR)
+    {
+        info.type = 1;
+    }
+    else
+    {
+        info.error = errno;
+    }
+#else
+    std::error_code status_ec;
+    const fs::file_type type = fs::status(p, status_ec).type();
+    info.type = uint8_filetype(type);
+    if (status_ec && type != fs::file_type::not_found)
+    {
+        info.error = status_ec.value();
+    }
+    if (info.type == 2)
+    {
+        std::error_code ec;
+        info.size = static_cast<uint64_t>(fs::file_size(p, ec));
+        info.allocated = info.size;
+    }
+
+    std::error_code ec;
+    info.mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        fs::last_write_time(p, ec).time_since_epoch()).count();
+#endif
+    return info;
+}
+
+// whether an entry needs a stat to know if it is a directory.  the type from
+// the directory listing is cached in the entry, so this only costs a system
+// call for symlinks (and on filesystems that don't report types)
+inline bool maybe_directory(const fs::directory_entry& entry)
+{
+    std::error_code ec;
+    return entry.is_directory(ec) || ec;
+}
+
+// true for kernel & automounter filesystems that are never worth crawling (and
+// that can be very slow or have side-effects when we try)
+inline bool is_pseudo_filesystem(const fs::path& p)
+{
+#if defined(__linux__)
+    struct statfs sfs;
+    if (::statfs(p.c_str(), &sfs) != 0)
+    {
+        return false;
+    }
+
+    switch (static_cast<uint32_t>(sfs.f_type))
+    {
+        case 0x9fa0:        // proc
+        case 0x62656572:    // sysfs
+        case 0x1cd1:        // devpts
+        case 0x27e0eb:      // cgroup
+        case 0x63677270:    // cgroup2
+        case 0x64626720:    // debugfs
+        case 0x74726163:    // tracefs
+        case 0x73636673:    // securityfs
+        case 0xf97cff8c:    // selinuxfs
+        case 0x43415d53:    // smackfs
+        case 0x6165676c:    // pstore
+        case 0xcafe4a11:    // bpf
+        case 0x62656570:    // configfs
+        case 0xde5e81e4:    // efivarfs
+        case 0x42494e4d:    // binfmt_misc
+        case 0x65735543:    // fusectl
+        case 0x958458f6:    // hugetlbfs
+        case 0x19800202:    // mqueue
+        case 0x6e736673:    // nsfs
+        case 0x67596969:    // rpc_pipefs
+        case 0x0187:        // autofs
+            return true;
+        default:
+            return false;
+    }
+#elif FSFIND_POSIX
+    struct statfs sfs;
+    if (::statfs(p.c_str(), &sfs) != 0)
+    {
+        return false;
+    }
+
+    return std::strcmp(sfs.f_fstypename, "devfs") == 0
+        || std::strcmp(sfs.f_fstypename, "autofs") == 0;
+#else
+    return false;
+#endif
+}
+
+// the equivalent of regexp(name, pattern, 'once') being non-empty
+inline bool is_match_all(const std::string& pattern)
+{
+    return pattern.empty() || pattern == ".*";
+}
+
+inline std::regex compile_pattern(const std::string& pattern, bool case_sensitive)
+{
+    auto flags = std::regex::ECMAScript | std::regex::optimize;
+    if (!case_sensitive)
+    {
+        flags |= std::regex::icase;
+    }
+    return std::regex(pattern, flags);
+}
+
+inline std::string to_lower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(),
+        [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return str;
+}
+
+// shell-style wildcard match of the entire name ('*', '?', '[...]' and '\' escapes);
+// '/' is only matched literally, and "**" matches across directories, which is
+// all that gitignore-style path patterns need on top of plain name globs
+inline bool glob_match(const char* glob, const char* name)
+{
+    while (*glob)
+    {
+        if (glob[0] == '*' && glob[1] == '*' && (glob[2] == '/' || glob[2] == '\0'))
+        {
+            if (glob[2] == '\0')
+            {
+                return true;
+            }
+
+            // "**/" matches zero or more leading directories
+            for (const char* s = name; ; s++)
+            {
+                if (glob_match(glob + 3, s))
+                {
+                    return true;
+                }
+                if ((s = std::strchr(s, '/')) == nullptr)
+                {
+                    return false;
+                }
+            }
+        }
+
+        if (*glob == '*')
+        {
+            glob++;
+            for (const char* s = name; ; s++)
+            {
+                if (glob_match(glob, s))
+                {
+                    return true;
+                }
+                if (*s == '\0' || *s == '/')
+                {
+                    return false;
+                }
+            }
+        }
+
+        if (*name == '\0')
+        {
+            return false;
+        }
+
+        if (*glob == '?')
+        {
+            if (*name == '/')
+            {
+                return false;
+            }
+            glob++;
+            name++;
+            continue;
+        }
+
+        if (*glob == '[')
+        {
+            const char* p = glob + 1;
+            const bool negate = (*p == '!' || *p == '^');
+            if (negate) p++;
+
+            bool in_class = false;
+            for (bool first = true; *p && (first || *p != ']'); first = false, p++)
+            {
+                if (p[1] == '-' && p[2] && p[2] != ']')
+                {
+                    in_class |= (*name >= p[0] && *name <= p[2]);
+                    p += 2;
+                }
+                else
+                {
+                    in_class |= (*name == *p);
+                }
+            }
+
+            // an unterminated class is just a literal '['
+            if (*p == ']')
+            {
+                if (*name == '/' || in_class == negate)
+                {
+                    return false;
+                }
+                glob = p + 1;
+                name++;
+                continue;
+            }
+        }
+
+        if (*glob == '\\' && glob[1] != '\0')
+        {
+            glob++;
+        }
+
+        if (*glob != *name)
+        {
+            return false;
+        }
+        glob++;
+        name++;
+    }
+
+    return *name == '\0';
+}
+
+// a set of names to prune; plain names are hashed so that the common case
+// (".git", "node_modules", ...) costs a single lookup per directory entry
+class name_filter
+{
+public:
+    name_filter() = default;
+
+    name_filter(const std::vector<std::string>& patterns, bool is_regex, bool case_sensitive)
+        : case_sensitive_(case_sensitive)
+    {
+        for (const auto& p : patterns)
+        {
+            if (p.empty())
+            {
+                continue;
+            }
+
+            if (is_regex)
+            {
+                regexes_.push_back(compile_pattern(p, case_sensitive));
+            }
+            else if (p.find_first_of("*?[") == std::string::npos)
+            {
+                exact_.insert(case_sensitive ? p : to_lower(p));
+            }
+            else
+            {
+                globs_.push_back(case_sensitive ? p : to_lower(p));
+            }
+        }
+    }
+
+    bool empty() const
+    {
+        return exact_.empty() && globs_.empty() && regexes_.empty();
+    }
+
+    bool matches(const std::string& name) const
+    {
+        if (empty())
+        {
+            return false;
+        }
+
+        const std::string folded = case_sensitive_ ? std::string() : to_lower(name);
+        const std::string& key = case_sensitive_ ? name : folded;
+
+        if (exact_.count(key) > 0)
+        {
+            return true;
+        }
+
+        for (const auto& g : globs_)
+        {
+            if (glob_match(g.c_str(), key.c_str()))
+            {
+                return true;
+            }
+        }
+
+        for (const auto& r : regexes_)
+        {
+            if (std::regex_search(name, r))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    bool case_sensitive_ = true;
+    std::unordered_set<std::string> exact_;
+    std::vector<std::string> globs_;
+    std::vector<std::regex> regexes_;
+};
+
+// ---------------------------------------------------------------------------
+// .gitignore / .ignore support
+// ---------------------------------------------------------------------------
+
+struct ignore_rule
+{
+    std::string glob;
+    bool negate = false;
+    bool dir_only = false;
+    bool anchored = false;  // matched against the relative path instead of the name
+};
+
+using ignore_rules = std::vector<ignore_rule>;
+
+// one level of the matcher stack: the rules found in a single directory, plus a
+// link to the rules of the directories above it.  directories without ignore
+// files simply share their parent's node, so siblings never copy anything.
+struct ignore_node
+{
+    std::shared_ptr<const ignore_node> parent;
+    std::shared_ptr<const ignore_rules> rules;
+    size_t base_length;     // length of "<dir>/" prefix stripped from paths
+};
+
+inline ignore_rules parse_ignore_file(const std::string& contents)
+{
+    ignore_rules rules;
+    size_t start = 0;
+
+    while (start < contents.size())
+    {
+        size_t end = contents.find('\n', start);
+        if (end == std::string::npos)
+        {
+            end = contents.size();
+        }
+
+        std::string line = contents.substr(start, end - start);
+        start = end + 1;
+
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        // trailing spaces are ignored unless they are escaped
+        while (!line.empty() && line.back() == ' '
+            && !(line.size() > 1 && line[line.size()-2] == '\\'))
+        {
+            line.pop_back();
+        }
+
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        ignore_rule rule;
+        if (line[0] == '!')
+        {
+            rule.negate = true;
+            line.erase(0, 1);
+        }
+        else if (line[0] == '\\' && line.size() > 1 && (line[1] == '#' || line[1] == '!'))
+        {
+            line.erase(0, 1);
+        }
+
+        if (!line.empty() && line.back() == '/')
+        {
+            rule.dir_only = true;
+            line.pop_back();
+        }
+
+        // a separator anywhere but the end ties the pattern to this directory
+        if (line.find('/') != std::string::npos)
+        {
+            rule.anchored = true;
+            if (line[0] == '/')
+            {
+                line.erase(0, 1);
+            }
+        }
+
+        if (!line.empty())
+        {
+            rule.glob = std::move(line);
+            rules.push_back(std::move(rule));
+        }
+    }
+
+    return rules;
+}
+
+inline bool read_file(const fs::path& p, std::string& contents)
+{
+    std::ifstream file(p, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// identical ignore files (very common in monorepos) are compiled only once;
+// shared by every crawler thread
+struct ignore_cache
+{
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<const ignore_rules>> rules;
+};
+
+// returns the matcher stack for entries of "dir"; if the directory has no ignore
+// files of its own, this is just the parent's stack
+inline std::shared_ptr<const ignore_node> load_ignore_files(
+    const fs::path& dir,
+    const std::shared_ptr<const ignore_node>& parent,
+    ignore_cache& cache)
+{
+    // .ignore is read last so that it takes precedence over .gitignore
+    std::string contents;
+    std::string file;
+    if (read_file(dir / ".gitignore", file))
+    {
+        contents += file;
+        contents += '\n';
+    }
+    if (read_file(dir / ".ignore", file))
+    {
+        contents += file;
+    }
+
+    if (contents.empty())
+    {
+        return parent;
+    }
+
+    std::shared_ptr<const ignore_rules> rules;
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        auto& cached = cache.rules[contents];
+        if (!cached)
+        {
+            cached = std::make_shared<const ignore_rules>(parse_ignore_file(contents));
+        }
+        rules = cached;
+    }
+    if (rules->empty())
+    {
+        return parent;
+    }
+
+    std::string base = dir.string();
+    if (!base.empty() && base.back() != fs::path::preferred_separator)
+    {
+        base += fs::path::preferred_separator;
+    }
+
+    return std::make_shared<const ignore_node>(ignore_node{parent, rules, base.size()});
+}
+
+// the last matching rule of the innermost ignore file decides, just like git
+inline bool is_ignored(const ignore_node* node, const std::string& path, const std::string& name, bool is_dir)
+{
+    for (; node != nullptr; node = node->parent.get())
+    {
+        const char* relative = path.c_str() + node->base_length;
+
+        for (auto rule = node->rules->rbegin(); rule != node->rules->rend(); ++rule)
+        {
+            if (rule->dir_only && !is_dir)
+            {
+                continue;
+            }
+            if (glob_match(rule->glob.c_str(), rule->anchored ? relative : name.c_str()))
+            {
+                return !rule->negate;
+            }
+        }
+    }
+
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// worker pool
+// ---------------------------------------------------------------------------
+
+// how often the calling thread checks for an interrupt while workers run
+constexpr std::chrono::milliseconds INTERRUPT_POLL_INTERVAL(20);
+
+inline size_t resolve_thread_count(double requested)
+{
+    if (requested >= 1)
+    {
+        return static_cast<size_t>(requested);
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// runs worker() on "threads" threads (including the calling thread)
+template <typename F>
+inline void run_workers(size_t threads, F worker)
+{
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; t++)
+    {
+        pool.emplace_back(worker);
+    }
+    worker();
+
+    for (auto& t : pool)
+    {
+        t.join();
+    }
+}
+
+// runs worker() on new threads, while the calling thread runs poll() every
+// "interval" until they have all finished.  this keeps the calling thread free
+// for things only it may do, like talking to MATLAB.  "initial" workers start
+// straight away; poll() returns how many it wants running, and more are
+// started (up to "threads" in all) as it asks for them.
+template <typename F, typename P>
+inline void run_workers_polling(size_t threads, size_t initial, F worker, std::chrono::milliseconds interval, P poll)
+{
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t running = 0;
+
+    std::vector<std::thread> pool;
+    auto grow = [&](size_t wanted)
+    {
+        // called with the lock held
+        wanted = std::min(wanted, threads);
+        while (pool.size() < wanted)
+        {
+            running++;
+            pool.emplace_back([&]()
+            {
+                worker();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    running--;
+                }
+                finished.notify_one();
+            });
+        }
+    };
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        grow(std::max<size_t>(1, initial));
+        while (!finished.wait_for(lock, interval, [&]() { return running == 0; }))
+        {
+            lock.unlock();
+            const size_t wanted = poll();
+            lock.lock();
+
+            // once they have all finished, there's nothing left to start them for
+            if (running > 0)
+            {
+                grow(wanted);
+            }
+        }
+    }
+
+    for (auto& t : pool)
+    {
+        t.join();
+    }
+}
+
+// runs fn(i) for i in [0, n) on up to "threads" workers; items are handed out
+// one at a time so a few huge files don't leave the other workers idle
+template <typename F>
+inline void parallel_for(size_t n, size_t threads, F fn)
+{
+    threads = std::min(threads, n);
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    run_workers(threads, [&]()
+    {
+        for (size_t i = next++; i < n; i = next++)
+        {
+            fn(i);
+        }
+    });
+}
+
+// parallel_for for the slow stages after the crawl.  search_options::interrupted
+// may only be called from the calling thread, so that thread polls it while the
+// workers run, and sets "cancelled" once it fires; no more items are started
+// after that (and fn() can check it to give up on a long one).
+template <typename F>
+inline void interruptible_for(size_t n, const search_options& opts, std::atomic<bool>& cancelled, F fn)
+{
+    if (!opts.interrupted)
+    {
+        parallel_for(n, resolve_thread_count(opts.threads), fn);
+        return;
+    }
+
+    if (cancelled || opts.interrupted())
+    {
+        cancelled = true;
+        return;
+    }
+
+    const size_t threads = std::min(resolve_thread_count(opts.threads), n);
+    std::atomic<size_t> next(0);
+    run_workers_polling(threads, threads, [&]()
+    {
+        for (size_t i = next++; i < n && !cancelled.load(std::memory_order_relaxed); i = next++)
+        {
+            fn(i);
+        }
+    }, INTERRUPT_POLL_INTERVAL, [&]()
+    {
+        if (!cancelled && opts.interrupted())
+        {
+            cancelled = true;
+        }
+        return threads;
+    });
+}
+
+// a queue that its own workers add to as they go.  pop() waits for an item and
+// returns false once the queue is empty and every worker is idle, since then
+// nothing can ever be added again; each successful pop() must be followed by
+// a call to done() when that item has been processed.  at most "limit" items
+// are handed out at once, no matter how many workers are waiting.
+template <typename T>
+class work_queue
+{
+public:
+    void set_limit(size_t limit)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            limit_ = std::max<size_t>(1, limit);
+        }
+        ready_.notify_all();
+    }
+
+    void push(T item)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            items_.push_back(std::move(item));
+        }
+        ready_.notify_one();
+    }
+
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this]()
+        {
+            return stopped_ || (!items_.empty() && busy_ < limit_) || (items_.empty() && busy_ == 0);
+        });
+
+        if (stopped_ || items_.empty())
+        {
+            return false;
+        }
+
+        item = std::move(items_.front());
+        items_.pop_front();
+        busy_++;
+        return true;
+    }
+
+    void done()
+    {
+        bool finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished = (--busy_ == 0 && items_.empty());
+        }
+
+        // a slot is free for one more item; if that was the last busy worker
+        // with nothing left to do, everyone can stop
+        if (finished)
+        {
+            ready_.notify_all();
+        }
+        else
+        {
+            ready_.notify_one();
+        }
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return items_.size();
+    }
+
+    // makes every pop() return false from now on (items can still be pushed)
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        ready_.notify_all();
+    }
+
+    // everything that was never handed out; only call once the workers are gone
+    std::deque<T> remaining()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return std::move(items_);
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<T> items_;
+    size_t busy_ = 0;
+    size_t limit_ = SIZE_MAX;
+    bool stopped_ = false;
+};
+
+// picks how many directories to read at once by hill climbing on throughput
+// (entries listed per second).  every window of reads, the limit takes a step:
+// additive increases for as long as they pay off (network & parallel
+// filesystems, where each read mostly waits), and multiplicative decreases
+// once extra readers stop helping (local disks, few cores), so that threads
+// aren't left contending for nothing.  flat throughput always means "fewer".
+class concurrency_limit
+{
+public:
+    concurrency_limit(size_t min, size_t max)
+        : min_(static_cast<double>(std::max<size_t>(1, min)))
+        , max_(static_cast<double>(std::max(min, max)))
+    {
+        limit_ = std::min(max_, std::max(min_, static_cast<double>(std::thread::hardware_concurrency())));
+    }
+
+    size_t get() const
+    {
+        return static_cast<size_t>(limit_ + 0.5);
+    }
+
+    // records one finished directory read; returns true if the limit changed
+    bool record(size_t entries)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if (min_ == max_)
+        {
+            return false;
+        }
+        if (samples_ == 0)
+        {
+            window_start_ = now;
+        }
+
+        work_ += entries + 1;
+
+        // each window spans a couple of reads per reader
+        if (++samples_ < std::max(MIN_WINDOW, 2 * get()))
+        {
+            return false;
+        }
+
+        const double seconds = std::chrono::duration<double>(now - window_start_).count();
+        const double rate = static_cast<double>(work_) / std::max(seconds, 1e-9);
+        work_ = 0;
+        samples_ = 0;
+
+        // keep going while throughput rises, otherwise turn around (never
+        // settling for more readers than needed)
+        const bool better = rate > rate_ * (1 + TOLERANCE);
+        const bool worse = rate < rate_ * (1 - TOLERANCE);
+        if (worse || (growing_ && !better))
+        {
+            growing_ = !growing_;
+        }
+        rate_ = rate;
+
+        const size_t before = get();
+        limit_ = growing_ ? limit_ + std::sqrt(limit_) : limit_ * BACKOFF;
+        limit_ = std::min(max_, std::max(min_, limit_));
+        return get() != before;
+    }
+
+private:
+    static constexpr size_t MIN_WINDOW = 16;
+    static constexpr double TOLERANCE = 0.1;
+    static constexpr double BACKOFF = 0.75;
+
+    double min_;
+    double max_;
+    double limit_;
+
+    bool growing_ = true;
+    double rate_ = 0;
+
+    std::chrono::steady_clock::time_point window_start_;
+    size_t work_ = 0;
+    size_t samples_ = 0;
+};
+
+// ---------------------------------------------------------------------------
+// content search
+// ---------------------------------------------------------------------------
+
+// files at least this big are mapped; anything smaller is read with one pread
+constexpr size_t MMAP_THRESHOLD = 256 * 1024;
+
+// read-only view of a file's contents, either mapped or copied into "buffer"
+class file_view
+{
+public:
+    file_view(const char* path, std::vector<char>& buffer)
+    {
+#if FSFIND_POSIX
+        const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            const size_t size = static_cast<size_t>(st.st_size);
+
+            if (size >= MMAP_THRESHOLD)
+            {
+                void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map != MAP_FAILED)
+                {
+                    ::madvise(map, size, MADV_SEQUENTIAL);
+                    data_ = static_cast<const char*>(map);
+                    size_ = size;
+                    mapped_ = true;
+                }
+            }
+
+            if (!mapped_)
+            {
+                buffer.resize(size);
+                size_t got = 0;
+                while (got < size)
+                {
+                    const ssize_t n = ::pread(fd, buffer.data() + got, size - got, static_cast<off_t>(got));
+                    if (n <= 0)
+                    {
+                        break;
+                    }
+                    got += static_cast<size_t>(n);
+                }
+                data_ = buffer.data();
+                size_ = got;
+            }
+        }
+        ok_ = true;
+        ::close(fd);
+#else
+        std::ifstream file(fs::u8path(path), std::ios::binary);
+        if (!file)
+        {
+            return;
+        }
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data_ = buffer.data();
+        size_ = buffer.size();
+        ok_ = true;
+#endif
+    }
+
+    ~file_view()
+    {
+#if FSFIND_POSIX
+        if (mapped_)
+        {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+    }
+
+    file_view(const file_view&) = delete;
+    file_view& operator=(const file_view&) = delete;
+
+    bool ok() const { return ok_; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    bool ok_ = false;
+};
+
+inline char ascii_lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+inline char ascii_upper(char c)
+{
+    return (c >= 'a' && c <= 'z') ? static_cast<char>(c - ('a' - 'A')) : c;
+}
+
+inline bool equals_literal(const char* data, const std::string& needle, bool case_sensitive)
+{
+    if (case_sensitive)
+    {
+        return std::memcmp(data, needle.data(), needle.size()) == 0;
+    }
+
+    for (size_t i = 0; i < needle.size(); i++)
+    {
+        if (ascii_lower(data[i]) != needle[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// offset of the first occurrence of "needle" (lowercase when !case_sensitive),
+// or SIZE_MAX.  the first & last bytes of the needle are tested 16 positions at
+// a time and only those candidates are compared in full.
+inline size_t find_literal(const char* data, size_t size, const std::string& needle, bool case_sensitive)
+{
+    const size_t n = needle.size();
+    if (n == 0)
+    {
+        return 0;
+    }
+    if (n > size)
+    {
+        return SIZE_MAX;
+    }
+
+    const char first_lo = needle.front();
+    const char last_lo = needle.back();
+    const char first_up = case_sensitive ? first_lo : ascii_upper(first_lo);
+    const char last_up = case_sensitive ? last_lo : ascii_upper(last_lo);
+
+    const size_t end = size - n + 1;    // number of candidate positions
+    size_t i = 0;
+
+#if FSFIND_SSE2
+    const __m128i f_lo = _mm_set1_epi8(first_lo);
+    const __m128i f_up = _mm_set1_epi8(first_up);
+    const __m128i l_lo = _mm_set1_epi8(last_lo);
+    const __m128i l_up = _mm_set1_epi8(last_up);
+
+    for (; i + 16 <= end; i += 16)
+    {
+        const __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + n - 1));
+
+        const __m128i hit = _mm_and_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(head, f_lo), _mm_cmpeq_epi8(head, f_up)),
+            _mm_or_si128(_mm_cmpeq_epi8(tail, l_lo), _mm_cmpeq_epi8(tail, l_up)));
+
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hit));
+        while (mask != 0)
+        {
+            const unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            if (equals_literal(data + i + bit, needle, case_sensitive))
+            {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i < end; i++)
+    {
+        const char c = data[i];
+        if ((c == first_lo || c == first_up) && equals_literal(data + i, needle, case_sensitive))
+        {
+            return i;
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+// 1-based line number of the byte at "offset"
+inline uint64_t line_number(const char* data, size_t offset)
+{
+    return static_cast<uint64_t>(std::count(data, data + offset, '\n')) + 1;
+}
+
+// lines matched against a regex between checks for an interrupt
+constexpr uint64_t CANCEL_CHECK_LINES = 4096;
+
+// returns the line of the first match (or 0 if there is no match, or the
+// search was cancelled part way)
+inline uint64_t search_contents(
+    const char* data, size_t size,
+    const std::string& text, const std::regex* regex, bool case_sensitive,
+    const std::atomic<bool>& cancelled)
+{
+    if (regex == nullptr)
+    {
+        const size_t offset = find_literal(data, size, text, case_sensitive);
+        return offset == SIZE_MAX ? 0 : line_number(data, offset);
+    }
+
+    // match line-by-line so that '^' and '$' behave like they do in grep
+    const char* const stop = data + size;
+    const char* begin = data;
+
+    for (uint64_t line = 1; ; line++)
+    {
+        const char* end = (begin == stop) ? nullptr
+            : static_cast<const char*>(std::memchr(begin, '\n', stop - begin));
+        if (end == nullptr)
+        {
+            end = stop;
+        }
+
+        if (std::regex_search(begin, end, *regex))
+        {
+            return line;
+        }
+        if (end == stop || end + 1 == stop)
+        {
+            return 0;
+        }
+        if ((line % CANCEL_CHECK_LINES) == 0 && cancelled.load(std::memory_order_relaxed))
+        {
+            return 0;
+        }
+        begin = end + 1;
+    }
+}
+
+// keeps only the regular files whose contents match, recording the first line
+inline void filter_contents(search_results& results, const search_options& opts, std::atomic<bool>& cancelled)
+{
+    std::unique_ptr<std::regex> regex;
+    std::string text = opts.contains_text;
+
+    if (!opts.contains_regex.empty())
+    {
+        regex = std::make_unique<std::regex>(compile_pattern(opts.contains_regex, opts.case_sensitive));
+    }
+    else if (!opts.case_sensitive)
+    {
+        text = to_lower(text);
+    }
+
+    const size_t N = results.size();
+    std::vector<uint64_t> lines(N, 0);
+
+    interruptible_for(N, opts, cancelled, [&](size_t i)
+    {
+        if (results.types[i] != 2)
+        {
+            return;
+        }
+
+        thread_local std::vector<char> buffer;
+        file_view view(results.path_string(i).c_str(), buffer);
+
+        if (view.ok())
+        {
+            lines[i] = search_contents(view.data(), view.size(), text, regex.get(), opts.case_sensitive, cancelled);
+        }
+    });
+
+    std::vector<size_t> keep;
+    for (size_t i = 0; i < N; i++)
+    {
+        if (lines[i] != 0)
+        {
+            keep.push_back(i);
+        }
+    }
+
+    results.lines = std::move(lines);
+    results.permute(keep);
+}
+
+// ---------------------------------------------------------------------------
+// file hashing (XXH3-64 and SHA-256)
+// ---------------------------------------------------------------------------
+
+inline uint32_t read_le32(const uint8_t* p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8)
+        | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline uint64_t read_le64(const uint8_t* p)
+{
+    return static_cast<uint64_t>(read_le32(p)) | (static_cast<uint64_t>(read_le32(p + 4)) << 32);
+}
+
+inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t bswap64(uint64_t x)
+{
+    x = ((x & 0x00FF00FF00FF00FFULL) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFULL);
+    x = ((x & 0x0000FFFF0000FFFFULL) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFULL);
+    return (x << 32) | (x >> 32);
+}
+
+// low ^ high halves of the full 128-bit product
+inline uint64_t mul128_fold64(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    const unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#else
+    const uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    const uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+    const uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+    const uint64_t hi_hi = (a >> 32) * (b >> 32);
+    const uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    const uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    const uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return lower ^ upper;
+#endif
+}
+
+// XXH3 64-bit hash (seed 0, default secret), bit-compatible with xxhash >= 0.8.0.
+// data can be fed in any chunk sizes; only 256 bytes are ever buffered.
+class xxh3_64
+{
+public:
+    void update(const void* data, size_t len)
+    {
+        const uint8_t* input = static_cast<const uint8_t*>(data);
+        const uint8_t* const end = input + len;
+        total_len_ += len;
+
+        if (buffered_ + len <= BUFFER_SIZE)
+        {
+            std::memcpy(buffer_ + buffered_, input, len);
+            buffered_ += len;
+            return;
+        }
+
+        if (buffered_ > 0)
+        {
+            const size_t fill = BUFFER_SIZE - buffered_;
+            std::memcpy(buffer_ + buffered_, input, fill);
+            input += fill;
+            consume_stripes(buffer_, BUFFER_SIZE / STRIPE_LEN);
+            buffered_ = 0;
+        }
+
+        // always keep at least one byte back so digest() has a final stripe
+        if (static_cast<size_t>(end - input) > BUFFER_SIZE)
+        {
+            const uint8_t* const limit = end - BUFFER_SIZE;
+            do
+            {
+                consume_stripes(input, BUFFER_SIZE / STRIPE_LEN);
+                input += BUFFER_SIZE;
+            } while (input < limit);
+
+            std::memcpy(buffer_ + BUFFER_SIZE - STRIPE_LEN, input - STRIPE_LEN, STRIPE_LEN);
+        }
+
+        buffered_ = static_cast<size_t>(end - input);
+        std::memcpy(buffer_, input, buffered_);
+    }
+
+    uint64_t digest() const
+    {
+        if (total_len_ <= MIDSIZE_MAX)
+        {
+            return hash_short(buffer_, static_cast<size_t>(total_len_));
+        }
+
+        xxh3_64 state = *this;
+        const uint8_t* last_stripe;
+        uint8_t catchup[STRIPE_LEN];
+
+        if (buffered_ >= STRIPE_LEN)
+        {
+            state.consume_stripes(buffer_, (buffered_ - 1) / STRIPE_LEN);
+            last_stripe = buffer_ + buffered_ - STRIPE_LEN;
+        }
+        else
+        {
+            const size_t catchup_size = STRIPE_LEN - buffered_;
+            std::memcpy(catchup, buffer_ + BUFFER_SIZE - catchup_size, catchup_size);
+            std::memcpy(catchup + catchup_size, buffer_, buffered_);
+            last_stripe = catchup;
+        }
+
+        accumulate_512(state.acc_, last_stripe, SECRET + SECRET_SIZE - STRIPE_LEN - 7);
+
+        uint64_t result = total_len_ * PRIME64_1;
+        for (size_t i = 0; i < 4; i++)
+        {
+            result += mul128_fold64(
+                state.acc_[2*i] ^ read_le64(SECRET + 11 + 16*i),
+                state.acc_[2*i+1] ^ read_le64(SECRET + 11 + 16*i + 8));
+        }
+        return avalanche(result);
+    }
+
+    static uint64_t hash(const void* data, size_t len)
+    {
+        xxh3_64 state;
+        state.update(data, len);
+        return state.digest();
+    }
+
+private:
+    static constexpr size_t STRIPE_LEN = 64;
+    static constexpr size_t BUFFER_SIZE = 256;
+    static constexpr size_t SECRET_SIZE = 192;
+    static constexpr size_t STRIPES_PER_BLOCK = (SECRET_SIZE - STRIPE_LEN) / 8;
+    static constexpr size_t MIDSIZE_MAX = 240;
+
+    static constexpr uint64_t PRIME32_1 = 0x9E3779B1U;
+    static constexpr uint64_t PRIME32_2 = 0x85EBCA77U;
+    static constexpr uint64_t PRIME32_3 = 0xC2B2AE3DU;
+    static constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+    static constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+    static constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+    static constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+    static constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+    static constexpr uint64_t PRIME_MX1 = 0x165667919E3779F9ULL;
+    static constexpr uint64_t PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+    static constexpr uint8_t SECRET[SECRET_SIZE] = {
+        0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+        0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+        0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+        0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+        0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+        0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+        0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+        0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+        0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+        0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+        0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+        0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+    };
+
+    static uint64_t xxh64_avalanche(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= PRIME64_2;
+        h ^= h >> 29;
+        h *= PRIME64_3;
+        return h ^ (h >> 32);
+    }
+
+    static uint64_t avalanche(uint64_t h)
+    {
+        h ^= h >> 37;
+        h *= PRIME_MX1;
+        return h ^ (h >> 32);
+    }
+
+    static uint64_t mix16(const uint8_t* input, const uint8_t* secret)
+    {
+        return mul128_fold64(
+            read_le64(input) ^ read_le64(secret),
+            read_le64(input + 8) ^ read_le64(secret + 8));
+    }
+
+    static uint64_t hash_short(const uint8_t* input, size_t len)
+    {
+        if (len == 0)
+        {
+            return xxh64_avalanche(read_le64(SECRET + 56) ^ read_le64(SECRET + 64));
+        }
+
+        if (len <= 3)
+        {
+            const uint32_t combined = (static_cast<uint32_t>(input[0]) << 16)
+                | (static_cast<uint32_t>(input[len >> 1]) << 24)
+                | static_cast<uint32_t>(input[len - 1])
+                | static_cast<uint32_t>(len << 8);
+            const uint64_t bitflip = read_le32(SECRET) ^ read_le32(SECRET + 4);
+            return xxh64_avalanche(combined ^ bitflip);
+        }
+
+        if (len <= 8)
+        {
+            const uint64_t bitflip = read_le64(SECRET + 8) ^ read_le64(SECRET + 16);
+            const uint64_t input64 = read_le32(input + len - 4)
+                + (static_cast<uint64_t>(read_le32(input)) << 32);
+            uint64_t h = input64 ^ bitflip;
+            h ^= rotl64(h, 49) ^ rotl64(h, 24);
+            h *= PRIME_MX2;
+            h ^= (h >> 35) + len;
+            h *= PRIME_MX2;
+            return h ^ (h >> 28);
+        }
+
+        if (len <= 16)
+        {
+            const uint64_t lo = read_le64(input) ^ (read_le64(SECRET + 24) ^ read_le64(SECRET + 32));
+            const uint64_t hi = read_le64(input + len - 8) ^ (read_le64(SECRET + 40) ^ read_le64(SECRET + 48));
+            const uint64_t acc = len + bswap64(lo) + hi + mul128_fold64(lo, hi);
+            return avalanche(acc);
+        }
+
+        uint64_t acc = len * PRIME64_1;
+
+        if (len <= 128)
+        {
+            if (len > 32)
+            {
+                if (len > 64)
+                {
+                    if (len > 96)
+                    {
+                        acc += mix16(input + 48, SECRET + 96);
+                        acc += mix16(input + len - 64, SECRET + 112);
+                    }
+                    acc += mix16(input + 32, SECRET + 64);
+                    acc += mix16(input + len - 48, SECRET + 80);
+                }
+                acc += mix16(input + 16, SECRET + 32);
+                acc += mix16(input + len - 32, SECRET + 48);
+            }
+            acc += mix16(input, SECRET);
+            acc += mix16(input + len - 16, SECRET + 16);
+            return avalanche(acc);
+        }
+
+        for (size_t i = 0; i < 8; i++)
+        {
+            acc += mix16(input + 16*i, SECRET + 16*i);
+        }
+        acc = avalanche(acc);
+
+        for (size_t i = 8; i < len / 16; i++)
+        {
+            acc += mix16(input + 16*i, SECRET + 16*(i-8) + 3);
+        }
+        acc += mix16(input + len - 16, SECRET + 136 - 17);
+        return avalanche(acc);
+    }
+
+    static void accumulate_512(uint64_t* acc, const uint8_t* input, const uint8_t* secret)
+    {
+        for (size_t i = 0; i < 8; i++)
+        {
+            const uint64_t value = read_le64(input + 8*i);
+            const uint64_t key = value ^ read_le64(secret + 8*i);
+            acc[i ^ 1] += value;
+            acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+        }
+    }
+
+    static void scramble(uint64_t* acc, const uint8_t* secret)
+    {
+        for (size_t i = 0; i < 8; i++)
+        {
+            uint64_t a = acc[i];
+            a ^= a >> 47;
+            a ^= read_le64(secret + 8*i);
+            acc[i] = a * PRIME32_1;
+        }
+    }
+
+    void consume_stripes(const uint8_t* input, size_t stripes)
+    {
+        for (size_t i = 0; i < stripes; i++)
+        {
+            accumulate_512(acc_, input + i*STRIPE_LEN, SECRET + stripes_so_far_*8);
+            if (++stripes_so_far_ == STRIPES_PER_BLOCK)
+            {
+                scramble(acc_, SECRET + SECRET_SIZE - STRIPE_LEN);
+                stripes_so_far_ = 0;
+            }
+        }
+    }
+
+    uint64_t acc_[8] = {PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1};
+    uint8_t buffer_[BUFFER_SIZE] = {};
+    size_t buffered_ = 0;
+    size_t stripes_so_far_ = 0;
+    uint64_t total_len_ = 0;
+};
+
+// FIPS 180-4 SHA-256
+class sha256
+{
+public:
+    void update(const void* data, size_t len)
+    {
+        const uint8_t* input = static_cast<const uint8_t*>(data);
+        total_len_ += len;
+
+        while (len > 0)
+        {
+            const size_t take = std::min(len, sizeof(block_) - buffered_);
+            std::memcpy(block_ + buffered_, input, take);
+            buffered_ += take;
+            input += take;
+            len -= take;
+
+            if (buffered_ == sizeof(block_))
+            {
+                transform(block_);
+                buffered_ = 0;
+            }
+        }
+    }
+
+    std::array<uint8_t, 32> digest() const
+    {
+        sha256 state = *this;
+        const uint64_t bits = total_len_ * 8;
+
+        const uint8_t pad = 0x80;
+        state.update(&pad, 1);
+        const uint8_t zero = 0;
+        while (state.buffered_ != 56)
+        {
+            state.update(&zero, 1);
+        }
+
+        uint8_t length[8];
+        for (int i = 0; i < 8; i++)
+        {
+            length[i] = static_cast<uint8_t>(bits >> (56 - 8*i));
+        }
+        state.update(length, 8);
+
+        std::array<uint8_t, 32> out;
+        for (size_t i = 0; i < 8; i++)
+        {
+            for (size_t j = 0; j < 4; j++)
+            {
+                out[4*i + j] = static_cast<uint8_t>(state.h_[i] >> (24 - 8*j));
+            }
+        }
+        return out;
+    }
+
+private:
+    static uint32_t rotr(uint32_t x, int r)
+    {
+        return (x >> r) | (x << (32 - r));
+    }
+
+    void transform(const uint8_t* chunk)
+    {
+        static constexpr uint32_t K[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+
+        uint32_t w[64];
+        for (size_t i = 0; i < 16; i++)
+        {
+            w[i] = (static_cast<uint32_t>(chunk[4*i]) << 24) | (static_cast<uint32_t>(chunk[4*i+1]) << 16)
+                | (static_cast<uint32_t>(chunk[4*i+2]) << 8) | static_cast<uint32_t>(chunk[4*i+3]);
+        }
+        for (size_t i = 16; i < 64; i++)
+        {
+            const uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+            const uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+            w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+
+        uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3];
+        uint32_t e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+
+        for (size_t i = 0; i < 64; i++)
+        {
+            const uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+            const uint32_t ch = (e & f) ^ (~e & g);
+            const uint32_t t1 = h + s1 + ch + K[i] + w[i];
+            const uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+            const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            const uint32_t t2 = s0 + maj;
+
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        h_[0] += a; h_[1] += b; h_[2] += c; h_[3] += d;
+        h_[4] += e; h_[5] += f; h_[6] += g; h_[7] += h;
+    }
+
+    uint32_t h_[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    uint8_t block_[64] = {};
+    size_t buffered_ = 0;
+    uint64_t total_len_ = 0;
+};
+
+inline std::string to_hex(const uint8_t* bytes, size_t n)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string out(2*n, '0');
+    for (size_t i = 0; i < n; i++)
+    {
+        out[2*i] = digits[bytes[i] >> 4];
+        out[2*i+1] = digits[bytes[i] & 0xF];
+    }
+    return out;
+}
+
+// streams a file through consume(data, size) using large sequential reads;
+// returns false if the file could not be opened or read (or was cancelled)
+template <typename F>
+inline bool read_chunks(const char* path, const std::atomic<bool>& cancelled, F consume)
+{
+    constexpr size_t CHUNK_SIZE = 1 << 20;
+    thread_local std::vector<char> buffer(CHUNK_SIZE);
+
+#if FSFIND_POSIX
+    const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+#if defined(POSIX_FADV_SEQUENTIAL)
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    bool ok = true;
+    for (;;)
+    {
+        if (cancelled.load(std::memory_order_relaxed))
+        {
+            ok = false;
+            break;
+        }
+
+        const ssize_t n = ::read(fd, buffer.data(), CHUNK_SIZE);
+        if (n == 0)
+        {
+            break;
+        }
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ok = false;
+            break;
+        }
+        consume(buffer.data(), static_cast<size_t>(n));
+    }
+    ::close(fd);
+    return ok;
+#else
+    std::ifstream file(fs::u8path(path), std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    while (file)
+    {
+        if (cancelled.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        file.read(buffer.data(), CHUNK_SIZE);
+        consume(buffer.data(), static_cast<size_t>(file.gcount()));
+    }
+    return file.eof();
+#endif
+}
+
+// hex digest of a file's contents (empty if the file cannot be read)
+inline std::string hash_file(const char* path, hash_kind kind, const std::atomic<bool>& cancelled)
+{
+    if (kind == hash_kind::xxh3)
+    {
+        xxh3_64 xxh;
+        if (!read_chunks(path, cancelled, [&](const char* data, size_t n) { xxh.update(data, n); }))
+        {
+            return std::string();
+        }
+
+        const uint64_t h = xxh.digest();
+        uint8_t bytes[8];
+        for (int i = 0; i < 8; i++)
+        {
+            bytes[i] = static_cast<uint8_t>(h >> (56 - 8*i));
+        }
+        return to_hex(bytes, 8);
+    }
+
+    sha256 sha;
+    if (!read_chunks(path, cancelled, [&](const char* data, size_t n) { sha.update(data, n); }))
+    {
+        return std::string();
+    }
+
+    const auto digest = sha.digest();
+    return to_hex(digest.data(), digest.size());
+}
+
+// hashes every regular file in the results on the worker pool
+inline void hash_results(search_results& results, const search_options& opts, std::atomic<bool>& cancelled)
+{
+    results.hashes.assign(results.size(), std::string());
+
+    interruptible_for(results.size(), opts, cancelled, [&](size_t i)
+    {
+        if (results.types[i] == 2)
+        {
+            results.hashes[i] = hash_file(results.path_string(i).c_str(), opts.hash, cancelled);
+        }
+    });
+}
+
+// ---------------------------------------------------------------------------
+// duplicate files
+// ---------------------------------------------------------------------------
+
+struct inode_hash
+{
+    size_t operator()(const std::pair<uint64_t, uint64_t>& id) const
+    {
+        return std::hash<uint64_t>()(id.first * 0x9E3779B97F4A7C15ULL ^ id.second);
+    }
+};
+
+// bytes hashed from each end of a file before falling back to a full hash
+constexpr uint64_t DUPLICATE_EDGE_SIZE = 64 * 1024;
+
+// XXH3 of the first & last 64 KiB; for files up to 128 KiB this covers every
+// byte, so equal sizes + equal partial hashes already means equal contents
+inline bool partial_hash(const char* path, uint64_t size, uint64_t& hash)
+{
+    thread_local std::vector<char> buffer(2 * DUPLICATE_EDGE_SIZE);
+
+    const size_t head = static_cast<size_t>(std::min(size, DUPLICATE_EDGE_SIZE));
+    const size_t tail = size > DUPLICATE_EDGE_SIZE ? static_cast<size_t>(DUPLICATE_EDGE_SIZE) : 0;
+
+#if FSFIND_POSIX
+    const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    bool ok = ::pread(fd, buffer.data(), head, 0) == static_cast<ssize_t>(head);
+    if (ok && tail > 0)
+    {
+        ok = ::pread(fd, buffer.data() + head, tail, static_cast<off_t>(size - tail))
+            == static_cast<ssize_t>(tail);
+    }
+    ::close(fd);
+#else
+    std::ifstream file(fs::u8path(path), std::ios::binary);
+    bool ok = static_cast<bool>(file.read(buffer.data(), head));
+    if (ok && tail > 0)
+    {
+        file.seekg(static_cast<std::streamoff>(size - tail));
+        ok = static_cast<bool>(file.read(buffer.data() + head, tail));
+    }
+#endif
+
+    if (ok)
+    {
+        hash = xxh3_64::hash(buffer.data(), head + tail);
+    }
+    return ok;
+}
+
+inline bool full_hash(const char* path, uint64_t& hash, const std::atomic<bool>& cancelled)
+{
+    xxh3_64 xxh;
+    if (!read_chunks(path, cancelled, [&](const char* data, size_t n) { xxh.update(data, n); }))
+    {
+        return false;
+    }
+    hash = xxh.digest();
+    return true;
+}
+
+// splits every group by key, dropping members without a key and any
+// sub-group that is left with a single member
+inline std::vector<std::vector<size_t>> split_groups(
+    const std::vector<std::vector<size_t>>& groups,
+    const std::unordered_map<size_t, uint64_t>& keys)
+{
+    std::vector<std::vector<size_t>> out;
+
+    for (const auto& group : groups)
+    {
+        std::unordered_map<uint64_t, size_t> slot;
+        const size_t first = out.size();
+
+        for (size_t i : group)
+        {
+            auto key = keys.find(i);
+            if (key == keys.end())
+            {
+                continue;
+            }
+
+            auto it = slot.emplace(key->second, out.size()).first;
+            if (it->second == out.size())
+            {
+                out.emplace_back();
+            }
+            out[it->second].push_back(i);
+        }
+
+        out.erase(std::remove_if(out.begin() + first, out.end(),
+            [](const std::vector<size_t>& g) { return g.size() < 2; }), out.end());
+    }
+
+    return out;
+}
+
+// computes key(i) for every member of every group on the worker pool
+template <typename F>
+inline std::unordered_map<size_t, uint64_t> parallel_keys(
+    const std::vector<std::vector<size_t>>& groups, const search_options& opts, std::atomic<bool>& cancelled, F key)
+{
+    std::vector<size_t> members;
+    for (const auto& group : groups)
+    {
+        members.insert(members.end(), group.begin(), group.end());
+    }
+
+    std::vector<uint64_t> values(members.size());
+    std::vector<char> ok(members.size(), 0);
+
+    interruptible_for(members.size(), opts, cancelled, [&](size_t k)
+    {
+        ok[k] = key(members[k], values[k]);
+    });
+
+    std::unordered_map<size_t, uint64_t> keys;
+    for (size_t k = 0; k < members.size(); k++)
+    {
+        if (ok[k])
+        {
+            keys.emplace(members[k], values[k]);
+        }
+    }
+    return keys;
+}
+
+// groups regular files with identical contents.  each stage only looks at the
+// survivors of the previous one: size -> partial hash -> full hash.
+duplicate_groups find_duplicates(const search_results& results, const search_options& opts)
+{
+    duplicate_groups out;
+    std::atomic<bool> cancelled(false);
+
+    // hard links are found from (dev, ino) alone and never read
+    std::unordered_map<std::pair<uint64_t, uint64_t>, size_t, inode_hash> inodes;
+    std::vector<std::vector<size_t>> links;
+    std::vector<size_t> candidates;
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        if (results.types[i] != 2 || results.sizes[i] < opts.min_size)
+        {
+            continue;
+        }
+
+        // an inode of 0 means the platform could not tell us
+        if (results.inodes[i].second != 0)
+        {
+            auto it = inodes.emplace(results.inodes[i], links.size()).first;
+            if (it->second != links.size())
+            {
+                links[it->second].push_back(i);
+                continue;
+            }
+            links.push_back({i});
+        }
+
+        candidates.push_back(i);
+    }
+
+    for (auto& group : links)
+    {
+        if (group.size() > 1)
+        {
+            out.hard_links.push_back(std::move(group));
+        }
+    }
+
+    // stage 1: size
+    std::unordered_map<size_t, uint64_t> sizes;
+    for (size_t i : candidates)
+    {
+        sizes.emplace(i, results.sizes[i]);
+    }
+    auto groups = split_groups({candidates}, sizes);
+
+    // stage 2: first & last 64 KiB
+    groups = split_groups(groups, parallel_keys(groups, opts, cancelled, [&](size_t i, uint64_t& h)
+    {
+        return partial_hash(results.path_string(i).c_str(), results.sizes[i], h);
+    }));
+    if (cancelled)
+    {
+        out.interrupted = true;
+        return out;
+    }
+
+    // stage 3: everything, but only for files the partial hash did not cover
+    std::vector<std::vector<size_t>> large;
+    for (auto& group : groups)
+    {
+        if (results.sizes[group.front()] > 2 * DUPLICATE_EDGE_SIZE)
+        {
+            large.push_back(std::move(group));
+        }
+        else
+        {
+            out.duplicates.push_back(std::move(group));
+        }
+    }
+
+    for (auto& group : split_groups(large, parallel_keys(large, opts, cancelled, [&](size_t i, uint64_t& h)
+        {
+            return full_hash(results.path_string(i).c_str(), h, cancelled);
+        })))
+    {
+        out.duplicates.push_back(std::move(group));
+    }
+    out.interrupted = cancelled;
+
+    // report groups in the order they were found
+    std::sort(out.duplicates.begin(), out.duplicates.end());
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// sorting
+// ---------------------------------------------------------------------------
+
+// ranges smaller than this are finished with a comparison sort
+constexpr size_t RADIX_CUTOFF = 64;
+
+// ranges at least this big have their buckets sorted on the worker pool
+constexpr size_t PARALLEL_RADIX_MIN = 1 << 16;
+
+// MSD radix sort of [first, last) by the bytes of key(i), starting at "depth";
+// entries whose keys are identical are ordered by tie(a, b)
+template <typename Key, typename Tie>
+inline void radix_sort(size_t* first, size_t* last, size_t* scratch, size_t depth,
+    const Key& key, const Tie& tie, size_t threads)
+{
+    for (;;)
+    {
+        const size_t n = static_cast<size_t>(last - first);
+
+        if (n < RADIX_CUTOFF)
+        {
+            std::sort(first, last, [&](size_t a, size_t b)
+            {
+                const int c = key(a).compare(key(b));
+                return c != 0 ? c < 0 : tie(a, b);
+            });
+            return;
+        }
+
+        // bucket 0 holds keys that end before "depth"
+        auto bucket = [&](size_t i)
+        {
+            const std::string_view k = key(i);
+            return depth < k.size() ? static_cast<size_t>(static_cast<uint8_t>(k[depth])) + 1 : 0;
+        };
+
+        size_t count[257] = {};
+        for (size_t* p = first; p != last; p++)
+        {
+            count[bucket(*p)]++;
+        }
+
+        // a shared prefix (like the search root) costs one counting pass per
+        // byte and never moves anything
+        const size_t b0 = bucket(*first);
+        if (count[b0] == n)
+        {
+            if (b0 == 0)
+            {
+                std::sort(first, last, tie);
+                return;
+            }
+            depth++;
+            continue;
+        }
+
+        size_t start[258] = {};
+        for (size_t b = 0; b < 257; b++)
+        {
+            start[b+1] = start[b] + count[b];
+        }
+
+        size_t next[257];
+        std::copy(start, start + 257, next);
+        for (size_t* p = first; p != last; p++)
+        {
+            scratch[next[bucket(*p)]++] = *p;
+        }
+        std::copy(scratch, scratch + n, first);
+
+        std::sort(first, first + count[0], tie);
+
+        auto sort_bucket = [&](size_t b)
+        {
+            if (count[b] > 1)
+            {
+                radix_sort(first + start[b], first + start[b+1], scratch + start[b], depth + 1,
+                    key, tie, 1);
+            }
+        };
+
+        if (threads > 1 && n >= PARALLEL_RADIX_MIN)
+        {
+            parallel_for(256, threads, [&](size_t b) { sort_bucket(b + 1); });
+        }
+        else
+        {
+            for (size_t b = 1; b < 257; b++)
+            {
+                sort_bucket(b);
+            }
+        }
+        return;
+    }
+}
+
+// stable LSD radix sort of "order" by an unsigned 64-bit key
+inline void radix_sort_u64(std::vector<size_t>& order, const std::vector<uint64_t>& keys)
+{
+    std::vector<size_t> scratch(order.size());
+
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        size_t count[256] = {};
+        for (size_t i : order)
+        {
+            count[(keys[i] >> shift) & 0xFF]++;
+        }
+
+        // skip bytes that are the same for every key
+        if (count[(keys[order.front()] >> shift) & 0xFF] == order.size())
+        {
+            continue;
+        }
+
+        size_t next[256];
+        size_t total = 0;
+        for (size_t b = 0; b < 256; b++)
+        {
+            next[b] = total;
+            total += count[b];
+        }
+
+        for (size_t i : order)
+        {
+            scratch[next[(keys[i] >> shift) & 0xFF]++] = i;
+        }
+        order.swap(scratch);
+    }
+}
+
+inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// "file2" < "file10"; letters compare without case, and anything equal that
+// way falls back to plain byte order so the result is still deterministic
+inline bool natural_less(std::string_view a, std::string_view b)
+{
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < a.size() && j < b.size())
+    {
+        if (is_digit(a[i]) && is_digit(b[j]))
+        {
+            while (i < a.size() && a[i] == '0') i++;
+            while (j < b.size() && b[j] == '0') j++;
+
+            size_t ni = i;
+            size_t nj = j;
+            while (ni < a.size() && is_digit(a[ni])) ni++;
+            while (nj < b.size() && is_digit(b[nj])) nj++;
+
+            if (ni - i != nj - j)
+            {
+                return ni - i < nj - j;
+            }
+
+            const int c = a.substr(i, ni - i).compare(b.substr(j, nj - j));
+            if (c != 0)
+            {
+                return c < 0;
+            }
+
+            i = ni;
+            j = nj;
+            continue;
+        }
+
+        const char ca = ascii_lower(a[i]);
+        const char cb = ascii_lower(b[j]);
+        if (ca != cb)
+        {
+            return static_cast<uint8_t>(ca) < static_cast<uint8_t>(cb);
+        }
+        i++;
+        j++;
+    }
+
+    if (i < a.size() || j < b.size())
+    {
+        return j < b.size();
+    }
+    return a < b;
+}
+
+// std::sort on equal slices in parallel, then pairwise merges
+template <typename Less>
+inline void parallel_sort(std::vector<size_t>& order, const Less& less, size_t threads)
+{
+    const size_t n = order.size();
+    const size_t parts = std::max<size_t>(1, std::min(threads, n / RADIX_CUTOFF));
+
+    std::vector<size_t> bounds;
+    for (size_t p = 0; p <= parts; p++)
+    {
+        bounds.push_back(n * p / parts);
+    }
+
+    parallel_for(parts, threads, [&](size_t p)
+    {
+        std::sort(order.begin() + bounds[p], order.begin() + bounds[p+1], less);
+    });
+
+    for (size_t width = 1; width < parts; width *= 2)
+    {
+        std::vector<size_t> merges;
+        for (size_t p = 0; p + width < parts; p += 2*width)
+        {
+            merges.push_back(p);
+        }
+
+        parallel_for(merges.size(), threads, [&](size_t m)
+        {
+            const size_t p = merges[m];
+            std::inplace_merge(order.begin() + bounds[p],
+                order.begin() + bounds[p + width],
+                order.begin() + bounds[std::min(p + 2*width, parts)], less);
+        });
+    }
+}
+
+// the order that sorts the results; their paths must not have been spilled
+inline std::vector<size_t> sort_order(const search_results& results, const search_options& opts)
+{
+    const size_t threads = resolve_thread_count(opts.threads);
+
+    std::vector<size_t> order(results.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    if (order.empty())
+    {
+        return order;
+    }
+
+    std::vector<size_t> scratch(order.size());
+    auto by_path = [&](size_t i) { return results.path(i); };
+    auto by_index = [](size_t a, size_t b) { return a < b; };
+
+    switch (opts.sort)
+    {
+        case sort_key::name:
+            radix_sort(order.data(), order.data() + order.size(), scratch.data(), 0,
+                [&](size_t i) { return results.filename(i); },
+                [&](size_t a, size_t b) { return results.path(a) < results.path(b); },
+                threads);
+            break;
+
+        case sort_key::natural:
+            parallel_sort(order, [&](size_t a, size_t b)
+            {
+                return natural_less(results.path(a), results.path(b));
+            }, threads);
+            break;
+
+        default:
+            // sizes & times are stable-sorted on top of the path order
+            radix_sort(order.data(), order.data() + order.size(), scratch.data(), 0,
+                by_path, by_index, threads);
+            break;
+    }
+
+    if (opts.sort == sort_key::size)
+    {
+        radix_sort_u64(order, results.sizes);
+    }
+    else if (opts.sort == sort_key::mtime)
+    {
+        // flip the sign bit so that signed times sort correctly as unsigned
+        std::vector<uint64_t> keys(results.mtimes.size());
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            keys[i] = static_cast<uint64_t>(results.mtimes[i]) ^ (1ULL << 63);
+        }
+        radix_sort_u64(order, keys);
+    }
+
+    return order;
+}
+
+// a result as it is written to a sorted run
+struct run_header
+{
+    uint64_t index;     // position in the unsorted results
+    uint64_t size;
+    int64_t mtime;
+    uint32_t length;
+    uint32_t name;
+};
+
+struct run_entry
+{
+    run_header header;
+    std::string path;
+};
+
+// the same order as sort_order(), with ties going to the earlier result
+inline bool run_entry_less(const run_entry& a, const run_entry& b, sort_key key)
+{
+    switch (key)
+    {
+        case sort_key::name:
+        {
+            const int cmp = std::string_view(a.path).substr(a.header.name).compare(
+                std::string_view(b.path).substr(b.header.name));
+            if (cmp != 0)
+            {
+                return cmp < 0;
+            }
+            break;
+        }
+
+        case sort_key::natural:
+            if (natural_less(a.path, b.path) || natural_less(b.path, a.path))
+            {
+                return natural_less(a.path, b.path);
+            }
+            break;
+
+        case sort_key::size:
+            if (a.header.size != b.header.size)
+            {
+                return a.header.size < b.header.size;
+            }
+            break;
+
+        case sort_key::mtime:
+            if (a.header.mtime != b.header.mtime)
+            {
+                return a.header.mtime < b.header.mtime;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    const int cmp = a.path.compare(b.path);
+    return cmp != 0 ? cmp < 0 : a.header.index < b.header.index;
+}
+
+// reads the entries of one sorted run back in order, through a small buffer
+class run_reader
+{
+public:
+    run_reader(const temp_file& file, uint64_t begin, uint64_t end, size_t buffer_size)
+        : file_(&file), pos_(begin), end_(end), capacity_(buffer_size)
+    {
+    }
+
+    // false at the end of the run (or if it could not be read)
+    bool next(run_entry& entry)
+    {
+        if (!read(&entry.header, sizeof(entry.header)))
+        {
+            return false;
+        }
+        entry.path.resize(entry.header.length);
+        return read(&entry.path[0], entry.header.length);
+    }
+
+    bool failed() const
+    {
+        return failed_;
+    }
+
+private:
+    bool read(void* out, size_t n)
+    {
+        char* dst = static_cast<char*>(out);
+        while (n > 0)
+        {
+            if (head_ == buffer_.size())
+            {
+                const size_t n_read = static_cast<size_t>(std::min<uint64_t>(capacity_, end_ - pos_));
+                if (n_read == 0)
+                {
+                    return false;
+                }
+
+                buffer_.resize(n_read);
+                if (!file_->read(pos_, &buffer_[0], n_read))
+                {
+                    failed_ = true;
+                    return false;
+                }
+                pos_ += n_read;
+                head_ = 0;
+            }
+
+            const size_t take = std::min(n, buffer_.size() - head_);
+            std::memcpy(dst, buffer_.data() + head_, take);
+            head_ += take;
+            dst += take;
+            n -= take;
+        }
+        return true;
+    }
+
+    const temp_file* file_;
+    uint64_t pos_;
+    uint64_t end_;
+    size_t capacity_;
+    std::string buffer_;
+    size_t head_ = 0;
+    bool failed_ = false;
+};
+
+// entries written or merged between checks for an interrupt
+constexpr size_t INTERRUPT_CHECK_ENTRIES = 1 << 16;
+
+// sorts results whose paths no longer fit in memory.  runs that fit in a
+// quarter of the memory limit are sorted in memory (exactly like sort_order)
+// and written out, then merged into a new arena in their final order, so the
+// outputs are read back from it sequentially.  returns false if a temporary
+// file could not be written or read, leaving the results as they were.
+inline bool external_sort(search_results& results, const search_options& opts, std::atomic<bool>& cancelled)
+{
+    const size_t n = results.size();
+    const uint64_t run_bytes = std::max<uint64_t>(static_cast<uint64_t>(opts.memory_limit / 4), 1 << 20);
+
+    // the runs and the merge are driven from the calling thread, so it can
+    // check for an interrupt itself every so often (the results stay unsorted)
+    auto interrupted = [&](size_t i)
+    {
+        if ((i % INTERRUPT_CHECK_ENTRIES) == 0 && opts.interrupted && opts.interrupted())
+        {
+            cancelled = true;
+        }
+        return cancelled.load();
+    };
+
+    // make room for a run alongside the arena
+    results.arena.set_limit(opts.memory_limit / 2);
+
+    temp_file runs;
+    std::vector<std::pair<uint64_t, uint64_t>> bounds;
+    std::string block;
+    uint64_t offset = 0;
+
+    for (size_t first = 0; first < n; )
+    {
+        search_results part;
+        uint64_t bytes = 0;
+        size_t last = first;
+        for (; last < n && bytes < run_bytes; last++)
+        {
+            if (interrupted(last))
+            {
+                return false;
+            }
+            const std::string_view path = results.path(last);
+            part.add(path, path.size() - results.paths[last].name, results.types[last]);
+            if (!results.sizes.empty())
+            {
+                part.sizes.push_back(results.sizes[last]);
+            }
+            if (!results.mtimes.empty())
+            {
+                part.mtimes.push_back(results.mtimes[last]);
+            }
+            bytes += path.size() + 1;
+        }
+
+        const uint64_t begin = runs.size();
+        for (size_t j : sort_order(part, opts))
+        {
+            const std::string_view path = part.path(j);
+            const run_header header = {first + j,
+                part.sizes.empty() ? 0 : part.sizes[j],
+                part.mtimes.empty() ? 0 : part.mtimes[j],
+                part.paths[j].length, part.paths[j].name};
+
+            block.append(reinterpret_cast<const char*>(&header), sizeof(header));
+            block.append(path.data(), path.size());
+
+            if (block.size() >= (1 << 20))
+            {
+                if (!runs.append(block.data(), block.size(), offset))
+                {
+                    return false;
+                }
+                block.clear();
+            }
+        }
+        if (!block.empty() && !runs.append(block.data(), block.size(), offset))
+        {
+            return false;
+        }
+        block.clear();
+
+        bounds.emplace_back(begin, runs.size());
+        first = last;
+    }
+
+    // the unsorted paths are all on disk by now, so they can leave memory
+    results.arena.set_limit(0);
+
+    // a quarter of the limit for reading the runs back, half for the new arena
+    const size_t buffer_size = static_cast<size_t>(std::max<uint64_t>(
+        run_bytes / bounds.size(), 1 << 12));
+
+    std::vector<run_reader> readers;
+    std::vector<run_entry> heads(bounds.size());
+    for (const auto& b : bounds)
+    {
+        readers.emplace_back(runs, b.first, b.second, buffer_size);
+    }
+
+    auto later = [&](size_t a, size_t b) { return run_entry_less(heads[b], heads[a], opts.sort); };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+    for (size_t r = 0; r < readers.size(); r++)
+    {
+        if (readers[r].next(heads[r]))
+        {
+            heap.push(r);
+        }
+    }
+
+    path_arena merged;
+    merged.set_limit(opts.memory_limit / 2);
+    std::vector<result_path> sorted;
+    std::vector<size_t> order;
+    sorted.reserve(n);
+    order.reserve(n);
+
+    while (!heap.empty())
+    {
+        if (interrupted(order.size()))
+        {
+            return false;
+        }
+        const size_t r = heap.top();
+        heap.pop();
+
+        const run_entry& entry = heads[r];
+        sorted.push_back({merged.store(entry.path), entry.header.length, entry.header.name});
+        order.push_back(entry.header.index);
+
+        if (readers[r].next(heads[r]))
+        {
+            heap.push(r);
+        }
+        else if (readers[r].failed())
+        {
+            return false;
+        }
+    }
+
+    if (order.size() != n || merged.failed())
+    {
+        return false;
+    }
+
+    results.stats.spilled += results.arena.spilled() + runs.size();
+    results.arena = std::move(merged);
+    results.paths.clear();
+    results.permute(order);
+    results.paths = std::move(sorted);
+    return true;
+}
+
+inline void sort_results(search_results& results, const search_options& opts, std::atomic<bool>& cancelled)
+{
+    if (results.arena.spilled() == 0)
+    {
+        results.permute(sort_order(results, opts));
+        return;
+    }
+
+    if (!external_sort(results, opts, cancelled) && !cancelled)
+    {
+        // sort in place instead; slow, but the arena can only be read by one
+        // thread.  every chunk has to stay in memory for this, since a compare
+        // holds two paths at once and loading one could evict the other.
+        results.stats.spill_failed = true;
+        results.arena.set_limit(std::numeric_limits<double>::infinity());
+        search_options serial = opts;
+        serial.threads = 1;
+        results.permute(sort_order(results, serial));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// tree output
+// ---------------------------------------------------------------------------
+
+// entries of one directory are listed together (unless sorted by name), so the
+// hash lookup only runs when the directory changes from one result to the next
+directory_table build_directory_table(const search_results& results)
+{
+    directory_table out;
+    out.parent.reserve(results.size());
+
+    // keys are copies, since spilled paths don't stay put
+    std::unordered_map<std::string, uint32_t> index;
+    std::string last;
+    uint32_t last_index = 0;
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const size_t skip = results.prefixes.empty() ? 0 : results.prefixes[i];
+        const std::string_view prefix = results.path(i).substr(skip, results.paths[i].name - skip);
+
+        if (out.parent.empty() || prefix != last)
+        {
+            last = prefix;
+            auto it = index.find(last);
+            if (it == index.end())
+            {
+                // drop the separator before the name (but keep the root intact)
+                fs::path dir{last};
+                while (dir.has_relative_path() && !dir.has_filename())
+                {
+                    dir = dir.parent_path();
+                }
+
+                it = index.emplace(last, static_cast<uint32_t>(out.dirs.size())).first;
+                out.dirs.push_back(dir.string());
+            }
+            last_index = it->second;
+        }
+
+        out.parent.push_back(last_index);
+    }
+
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// folder listing
+// ---------------------------------------------------------------------------
+
+// each folder is listed (and its contents stat'd) by one worker, then the
+// listings are joined in the order of the folders
+folder_listing list_folders(const std::vector<std::string>& folders, bool need_types, double threads)
+{
+    struct listed
+    {
+        std::list<fs::path> paths;
+        std::vector<uint8_t> types;
+        std::error_code ec;
+    };
+
+    std::vector<listed> listings(folders.size());
+    parallel_for(folders.size(), resolve_thread_count(threads), [&](size_t i)
+    {
+        listed& l = listings[i];
+        l.paths = get_contents(folders[i], l.ec);
+        if (need_types)
+        {
+            l.types.reserve(l.paths.size());
+            for (const fs::path& p : l.paths)
+            {
+                l.types.push_back(uint8_filetype(p));
+            }
+        }
+    });
+
+    size_t n = 0;
+    for (const listed& l : listings)
+    {
+        n += l.paths.size();
+    }
+
+    folder_listing out;
+    out.paths.reserve(n);
+    out.folder.reserve(n);
+    out.types.reserve(need_types ? n : 0);
+
+    for (size_t i = 0; i < listings.size(); i++)
+    {
+        listed& l = listings[i];
+        if (l.ec)
+        {
+            out.errors.push_back({folders[i], l.ec, "opendir"});
+        }
+
+        out.folder.insert(out.folder.end(), l.paths.size(), static_cast<uint32_t>(i));
+        out.types.insert(out.types.end(), l.types.begin(), l.types.end());
+        std::move(l.paths.begin(), l.paths.end(), std::back_inserter(out.paths));
+        l = listed();
+    }
+
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// search
+// ---------------------------------------------------------------------------
+
+struct search_root
+{
+    fs::path path;
+    file_info info;
+    uint32_t prefix;    // length of "<root>/" at the start of every result path
+    fs::path canonical; // the same directory without symlinks or dots (for comparing roots)
+};
+
+// a directory waiting to be listed
+struct pending_dir
+{
+    fs::path path;
+    size_t depth;
+    uint64_t dev;
+    uint64_t ino;
+    size_t root;        // index of the search root it was found under
+    size_t batch;       // where the outcome of listing it is recorded
+    size_t usage;       // node that entries are totalled into (disk usage mode)
+    std::shared_ptr<const ignore_node> ignore;
+};
+
+// a file with more than one hard link (disk usage mode).  its bytes are only
+// counted once the directories are back in breadth-first order, so that the
+// first of its paths always gets them (whichever thread listed it first).
+struct linked_file
+{
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t allocated;
+};
+
+// what listing a single directory produced.  directories are finished in any
+// order by the workers, so this is what lets us put the results back in the
+// order a single-threaded breadth-first search would have found them.
+struct dir_batch
+{
+    size_t first = 0;               // results [first, first+count) came from here
+    size_t count = 0;
+    size_t usage = SIZE_MAX;        // the usage node created for this directory
+    size_t owner = SIZE_MAX;        // the usage node its entries are totalled into
+    std::vector<linked_file> linked;
+    std::vector<size_t> children;   // batches of its subdirectories, in listing order
+};
+
+// true if "inner" is "outer" or somewhere beneath it (both must be canonical)
+inline bool is_within(const fs::path& inner, const fs::path& outer)
+{
+    auto i = inner.begin();
+    for (auto o = outer.begin(); o != outer.end(); ++o, ++i)
+    {
+        if (i == inner.end() || *i != *o)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// drops roots that are the same directory as an earlier root, or that sit inside
+// another root whose crawl is certain to reach everything beneath them.  returns
+// true if any overlap is left, in which case results must be de-duplicated.
+inline bool remove_overlapping_roots(std::vector<search_root>& roots, const search_options& opts)
+{
+    // the same options only guarantee the same results when nothing can stop
+    // the outer crawl from reaching (all of) the inner root
+    const bool full_crawl = opts.depth == std::numeric_limits<double>::infinity()
+        && opts.depthwise_pattern.empty() && opts.exclude.empty() && opts.exclude_dirs.empty()
+        && !opts.respect_ignore_files;
+
+    for (auto& root : roots)
+    {
+        std::error_code ec;
+        fs::path p = fs::weakly_canonical(root.path, ec);
+        root.canonical = ec ? root.path : p;
+    }
+
+    std::vector<bool> drop(roots.size(), false);
+    bool overlap = false;
+
+    for (size_t i = 0; i < roots.size(); i++)
+    {
+        for (size_t j = 0; j < roots.size() && !drop[i]; j++)
+        {
+            if (i == j || drop[j])
+            {
+                continue;
+            }
+
+            const bool same = (roots[i].canonical == roots[j].canonical)
+                || (roots[i].info.type == 3 && roots[i].info.dev == roots[j].info.dev
+                    && roots[i].info.ino == roots[j].info.ino);
+
+            if (same)
+            {
+                drop[i] = (j < i);
+            }
+            else if (is_within(roots[i].canonical, roots[j].canonical))
+            {
+                if (full_crawl && roots[i].info.dev == roots[j].info.dev)
+                {
+                    drop[i] = true;
+                }
+                else
+                {
+                    overlap = true;
+                }
+            }
+        }
+    }
+
+    std::vector<search_root> kept;
+    for (size_t i = 0; i < roots.size(); i++)
+    {
+        if (!drop[i])
+        {
+            kept.push_back(std::move(roots[i]));
+        }
+    }
+    roots = std::move(kept);
+    return overlap;
+}
+
+// keeps only the first result for each path when overlapping roots found some
+// entries more than once.  only the root's part of a path is made canonical: one
+// root can reach a directory by several paths (through symlinks), and those are
+// all kept, just as they are without the overlap.
+inline void remove_repeated_results(search_results& results, const std::vector<search_root>& roots)
+{
+    std::vector<std::string> bases;
+    for (const search_root& root : roots)
+    {
+        std::string base = root.canonical.string();
+        if (base.empty() || base.back() != static_cast<char>(fs::path::preferred_separator))
+        {
+            base += fs::path::preferred_separator;
+        }
+        bases.push_back(std::move(base));
+    }
+
+    std::unordered_set<std::string> seen;
+    std::vector<size_t> keep;
+    keep.reserve(results.size());
+
+    std::string key;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const uint32_t r = results.root_index[i];
+        key = bases[r];
+        key.append(results.path(i).substr(roots[r].prefix));
+
+        if (seen.insert(key).second)
+        {
+            keep.push_back(i);
+        }
+    }
+
+    if (keep.size() < results.size())
+    {
+        results.permute(keep);
+    }
+}
+
+// keeps only the first result for each inode with more than one hard link
+inline void remove_repeated_inodes(search_results& results)
+{
+    std::unordered_set<std::pair<uint64_t, uint64_t>, inode_hash> seen;
+    std::vector<size_t> keep;
+    keep.reserve(results.size());
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        if (results.linked[i].second == 0 || seen.insert(results.linked[i]).second)
+        {
+            keep.push_back(i);
+        }
+    }
+
+    if (keep.size() < results.size())
+    {
+        results.permute(keep);
+    }
+    results.linked.clear();
+}
+
+// running totals of a single crawler thread.  only that thread ever writes
+// them, so a relaxed load + store is enough (no locked instructions), and each
+// set of counters has its own cache line so that threads never contend.
+struct alignas(64) progress_counters
+{
+    std::atomic<uint64_t> directories{0};
+    std::atomic<uint64_t> entries{0};
+    std::atomic<uint64_t> matches{0};
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+// how many entries of a directory are listed between checks of the deadline
+// (and for an interrupt)
+constexpr size_t STOP_CHECK_INTERVAL = 64;
+
+// breadth-first search that mirrors the non-MEX search in fsfind.m, except that
+// directories are pruned before they are ever opened.  every root is crawled
+// at once from a shared queue of directories on the worker pool, and the
+// results are then put back in the order of a serial search, root by root.
+search_results search(const std::vector<fs::path>& root_paths, const search_options& opts)
+{
+    const auto start = std::chrono::steady_clock::now();
+    search_results results;
+    results.arena.set_limit(opts.memory_limit);
+
+#if !FSFIND_POSIX
+    if (opts.same_filesystem)
+    {
+        throw std::invalid_argument("'SameFilesystem' is not supported on this platform.");
+    }
+#endif
+
+    std::vector<search_root> roots;
+    for (fs::path root : root_paths)
+    {
+        // remove trailing fileseps (but keep the root of the filesystem intact)
+        while (root.has_relative_path() && !root.has_filename())
+        {
+            root = root.parent_path();
+        }
+
+        // only the root of the filesystem still ends with a separator
+        const std::string root_path = root.string();
+        const char last = root_path.empty() ? '\0' : root_path.back();
+        const bool has_separator = (last == '/' || last == static_cast<char>(fs::path::preferred_separator));
+
+        // (the canonical path is filled in by remove_overlapping_roots)
+        roots.push_back({root, get_file_info(root),
+            static_cast<uint32_t>(root_path.size() + (has_separator ? 0 : 1)), fs::path()});
+    }
+
+    const bool overlap = remove_overlapping_roots(roots, opts);
+
+    const std::regex pattern = compile_pattern(
+        is_match_all(opts.pattern) ? ".*" : opts.pattern, opts.case_sensitive);
+    const bool filter_names = !is_match_all(opts.pattern);
+
+    std::vector<std::regex> depthwise;
+    std::vector<bool> filter_depth;
+    for (const auto& p : opts.depthwise_pattern)
+    {
+        filter_depth.push_back(!is_match_all(p));
+        depthwise.push_back(compile_pattern(filter_depth.back() ? p : ".*", opts.case_sensitive));
+    }
+
+    const name_filter exclude(opts.exclude, opts.exclude_regex, opts.case_sensitive);
+    const name_filter exclude_dirs(opts.exclude_dirs, opts.exclude_regex, opts.case_sensitive);
+
+    // when nothing needs the type (or size, etc.) of a result, only entries that
+    // might be directories are stat'd, which skips nearly every file
+    const bool stat_all = opts.need_types || opts.collect_stats || opts.collect_links || opts.unique_inodes
+        || opts.mode != search_mode::list || !opts.contains_text.empty() || !opts.contains_regex.empty() || opts.hash != hash_kind::none;
+
+    // results can only exist beyond the end of a depthwise filter
+    const size_t min_result_depth = opts.depthwise_pattern.size() + 1;
+
+    // in disk usage mode, each entry is added to the node of its deepest reported
+    // directory (without keeping its path), and hard-linked inodes are only
+    // counted the first time they're seen
+    const bool disk_usage = (opts.mode == search_mode::disk_usage);
+
+    // everything below is shared by the workers and guarded by "mutex"
+    std::mutex mutex;
+    std::vector<dir_batch> batches;
+
+    // cache the pseudo-filesystem check so it runs once per mounted device
+    std::unordered_map<uint64_t, bool> pseudo_fs;
+
+    ignore_cache ignore_files;
+    work_queue<pending_dir> queue;
+
+    // one worker per directory that may be read at once; the controller
+    // decides how many of them actually are
+    concurrency_limit concurrency(opts.min_concurrency, opts.max_concurrency);
+    queue.set_limit(concurrency.get());
+
+    // once the time is up no new directories are opened, and any that are
+    // still being listed are abandoned (and reported as unvisited)
+    const bool has_deadline = std::isfinite(opts.timeout);
+    const auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(has_deadline ? std::max(0.0, opts.timeout) : 0.0));
+    auto out_of_time = [&]()
+    {
+        return has_deadline && std::chrono::steady_clock::now() >= deadline;
+    };
+
+    // set from the calling thread when it is interrupted
+    std::atomic<bool> cancelled(false);
+    auto should_stop = [&]()
+    {
+        return cancelled.load(std::memory_order_relaxed) || out_of_time();
+    };
+
+    auto abandon = [&](const pending_dir& dir)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        results.unvisited.push_back({dir.path.string(), dir.depth - 1});
+        results.stats.timed_out = !cancelled;
+        queue.stop();
+    };
+
+    for (size_t r = 0; r < roots.size(); r++)
+    {
+        batches.emplace_back();
+        if (disk_usage)
+        {
+            batches.back().usage = results.usage.size();
+            results.usage.push_back({roots[r].path.string(), SIZE_MAX, 0});
+        }
+
+        queue.push({roots[r].path, 1, roots[r].info.dev, roots[r].info.ino,
+            r, r, batches.back().usage, nullptr});
+    }
+
+    struct found_entry
+    {
+        std::string path;
+        size_t name_length;
+        file_info info;
+    };
+
+    // readers are only started while there are directories waiting for them,
+    // so a small folder is listed by a single thread; 'Threads' caps them too
+    const size_t n_workers = std::max<size_t>(1, opts.threads >= 1
+        ? static_cast<size_t>(std::min(static_cast<double>(opts.max_concurrency), opts.threads))
+        : opts.max_concurrency);
+
+    // progress is tallied per worker, and only summed when it is reported
+    std::unique_ptr<progress_counters[]> progress(new progress_counters[n_workers]);
+    std::atomic<size_t> next_worker(0);
+
+    auto crawl = [&]()
+    {
+        progress_counters& counters = progress[next_worker++];
+        pending_dir dir;
+        std::vector<found_entry> found;
+        std::vector<pending_dir> subdirs;
+        std::vector<search_error> failed;
+
+        // disk usage of the directory being listed
+        uint64_t files = 0;
+        uint64_t dirs = 0;
+        uint64_t apparent = 0;
+        uint64_t allocated = 0;
+        std::vector<linked_file> linked;
+
+        while (queue.pop(dir))
+        {
+            if (should_stop())
+            {
+                abandon(dir);
+                queue.done();
+                continue;
+            }
+
+            found.clear();
+            subdirs.clear();
+            failed.clear();
+            files = dirs = apparent = allocated = 0;
+            linked.clear();
+
+            size_t entries = 0;
+            bool abandoned = false;
+
+            std::shared_ptr<const ignore_node> ignore;
+            if (opts.respect_ignore_files)
+            {
+                ignore = load_ignore_files(dir.path, dir.ignore, ignore_files);
+            }
+
+            std::error_code ec;
+            fs::directory_iterator it(dir.path, ec);
+            const char* operation = ec ? "opendir" : "readdir";
+
+            for (; !ec && it != fs::directory_iterator(); it.increment(ec))
+            {
+                // a huge directory (or a very slow one) can't hold up the deadline
+                if ((++entries % STOP_CHECK_INTERVAL) == 0)
+                {
+                    progress_counters::add(counters.entries, STOP_CHECK_INTERVAL);
+                    if (should_stop())
+                    {
+                        abandoned = true;
+                        break;
+                    }
+                }
+
+                const fs::path& p = it->path();
+                const std::string name = p.filename().string();
+
+                if (dir.depth <= depthwise.size() && filter_depth[dir.depth-1]
+                    && !std::regex_search(name, depthwise[dir.depth-1]))
+                {
+                    continue;
+                }
+
+                // excluded names are dropped before we even stat them
+                if (exclude.matches(name))
+                {
+                    continue;
+                }
+
+                const file_info info = (stat_all || maybe_directory(*it)) ? get_file_info(p) : file_info();
+                if (info.error != 0)
+                {
+                    failed.push_back({p.string(), std::error_code(info.error, std::system_category()), "stat"});
+                }
+
+                if (info.type == 3 && exclude_dirs.matches(name))
+                {
+                    continue;
+                }
+
+                if (opts.respect_ignore_files)
+                {
+                    if (info.type == 3 && name == ".git")
+                    {
+                        continue;
+                    }
+
+                    const std::string path = p.string();
+                    if (is_ignored(ignore.get(), path, name, info.type == 3))
+                    {
+                        continue;
+                    }
+                }
+
+                if (dir.depth >= min_result_depth
+                    && (!filter_names || std::regex_search(name, pattern)))
+                {
+                    if (!disk_usage)
+                    {
+                        found.push_back({p.string(), name.size(), info});
+                    }
+                    else if (info.type != 3 && info.nlink > 1)
+                    {
+                        files++;
+                        linked.push_back({info.dev, info.ino, info.size, info.allocated});
+                    }
+                    else
+                    {
+                        (info.type == 3 ? dirs : files)++;
+                        apparent += info.size;
+                        allocated += info.allocated;
+                    }
+                }
+
+                if (info.type != 3 || static_cast<double>(dir.depth) >= opts.depth)
+                {
+                    continue;
+                }
+
+                // prune mount boundaries before the directory is opened
+                if (info.dev != dir.dev)
+                {
+                    if (opts.same_filesystem && info.dev != roots[dir.root].info.dev)
+                    {
+                        continue;
+                    }
+
+                    if (opts.skip_pseudo_filesystems)
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        auto cached = pseudo_fs.find(info.dev);
+                        if (cached == pseudo_fs.end())
+                        {
+                            lock.unlock();
+                            const bool is_pseudo = is_pseudo_filesystem(p);
+                            lock.lock();
+                            cached = pseudo_fs.emplace(info.dev, is_pseudo).first;
+                        }
+                        if (cached->second)
+                        {
+                            continue;
+                        }
+                    }
+                }
+
+                subdirs.push_back({p, dir.depth + 1, info.dev, info.ino, dir.root, 0, dir.usage, ignore});
+            }
+
+            progress_counters::add(counters.entries, entries % STOP_CHECK_INTERVAL);
+
+            if (abandoned)
+            {
+                abandon(dir);
+                queue.done();
+                continue;
+            }
+
+            progress_counters::add(counters.directories, 1);
+            progress_counters::add(counters.matches, disk_usage ? files + dirs : found.size());
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                results.stats.directories++;
+                results.stats.entries += entries;
+                if (concurrency.record(entries))
+                {
+                    queue.set_limit(concurrency.get());
+                }
+
+                batches[dir.batch].first = results.size();
+                batches[dir.batch].count = found.size();
+
+                if (disk_usage)
+                {
+                    usage_node& node = results.usage[dir.usage];
+                    node.files += files;
+                    node.dirs += dirs;
+                    node.apparent += apparent;
+                    node.allocated += allocated;
+                    batches[dir.batch].owner = dir.usage;
+                    batches[dir.batch].linked = std::move(linked);
+                }
+
+                for (const found_entry& f : found)
+                {
+                    results.add(f.path, f.name_length, f.info.type);
+
+                    if (opts.collect_stats)
+                    {
+                        results.sizes.push_back(f.info.size);
+                        results.inodes.emplace_back(f.info.dev, f.info.ino);
+                        results.mtimes.push_back(f.info.mtime);
+                    }
+                    if (opts.collect_links)
+                    {
+                        results.links.push_back(f.info.type <= 1 ? 0 : f.info.nlink);
+                    }
+                    if (opts.unique_inodes)
+                    {
+                        const bool is_linked = (f.info.type != 3 && f.info.nlink > 1);
+                        results.linked.push_back(is_linked ? std::make_pair(f.info.dev, f.info.ino)
+                                                           : std::make_pair(uint64_t(0), uint64_t(0)));
+                    }
+                    if (opts.relative_paths)
+                    {
+                        results.prefixes.push_back(roots[dir.root].prefix);
+                    }
+                    if (overlap)
+                    {
+                        results.root_index.push_back(static_cast<uint32_t>(dir.root));
+                    }
+                }
+
+                for (pending_dir& sub : subdirs)
+                {
+                    sub.batch = batches.size();
+                    batches.emplace_back();
+                    batches[dir.batch].children.push_back(sub.batch);
+
+                    if (disk_usage && static_cast<double>(dir.depth) <= opts.report_depth)
+                    {
+                        sub.usage = results.usage.size();
+                        batches[sub.batch].usage = sub.usage;
+                        results.usage.push_back({sub.path.string(), dir.usage, dir.depth});
+                    }
+                }
+
+                if (ec)
+                {
+                    results.errors.push_back({dir.path.string(), ec, operation});
+                }
+                for (search_error& err : failed)
+                {
+                    results.errors.push_back(std::move(err));
+                }
+            }
+
+            for (pending_dir& sub : subdirs)
+            {
+                queue.push(std::move(sub));
+            }
+
+            queue.done();
+        }
+    };
+
+    bool progress_enabled = static_cast<bool>(opts.progress);
+    auto next_report = start;
+
+    auto send_progress = [&]()
+    {
+        uint64_t totals[3] = {0, 0, 0};
+        for (size_t i = 0; i < n_workers; i++)
+        {
+            totals[0] += progress[i].directories.load(std::memory_order_relaxed);
+            totals[1] += progress[i].entries.load(std::memory_order_relaxed);
+            totals[2] += progress[i].matches.load(std::memory_order_relaxed);
+        }
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        progress_enabled = opts.progress({totals[0], totals[1], totals[2], queue.size(), elapsed.count()});
+    };
+
+    // an interrupt that is already pending stops the search before it starts
+    // (a small tree can be crawled before the first poll)
+    if (opts.interrupted && opts.interrupted())
+    {
+        cancelled = true;
+        queue.stop();
+    }
+
+    // the workers crawl while this thread watches for interrupts & reports progress
+    run_workers_polling(n_workers, 1, crawl, INTERRUPT_POLL_INTERVAL, [&]()
+    {
+        if (!cancelled && opts.interrupted && opts.interrupted())
+        {
+            cancelled = true;
+            queue.stop();
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (progress_enabled && !cancelled && now >= next_report)
+        {
+            next_report = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(opts.progress_interval));
+            send_progress();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        return queue.size() > 0 ? concurrency.get() : 0;
+    });
+
+    // the final tally
+    if (progress_enabled && !cancelled)
+    {
+        send_progress();
+    }
+
+    results.stats.concurrency = concurrency.get();
+
+    // nothing is returned after an interrupt, so don't bother tidying up
+    if (cancelled)
+    {
+        results.stats.interrupted = true;
+        return results;
+    }
+
+    for (const pending_dir& dir : queue.remaining())
+    {
+        results.unvisited.push_back({dir.path.string(), dir.depth - 1});
+    }
+
+    // walk the directories breadth-first, one root at a time
+    std::vector<size_t> order;
+    std::vector<size_t> usage_order;
+    order.reserve(results.size());
+    usage_order.reserve(results.usage.size());
+
+    // hard-linked files are counted in the first directory they're found in
+    std::unordered_set<std::pair<uint64_t, uint64_t>, inode_hash> linked_inodes;
+
+    std::deque<size_t> walk;
+    for (size_t r = 0; r < roots.size(); r++)
+    {
+        walk.push_back(r);
+        while (!walk.empty())
+        {
+            const dir_batch& batch = batches[walk.front()];
+            walk.pop_front();
+
+            for (const linked_file& f : batch.linked)
+            {
+                if (linked_inodes.emplace(f.dev, f.ino).second)
+                {
+                    results.usage[batch.owner].apparent += f.size;
+                    results.usage[batch.owner].allocated += f.allocated;
+                }
+            }
+
+            for (size_t i = batch.first; i < batch.first + batch.count; i++)
+            {
+                order.push_back(i);
+            }
+            if (batch.usage != SIZE_MAX)
+            {
+                usage_order.push_back(batch.usage);
+            }
+            walk.insert(walk.end(), batch.children.begin(), batch.children.end());
+        }
+    }
+
+    results.permute(order);
+
+    if (overlap)
+    {
+        remove_repeated_results(results, roots);
+    }
+
+    if (disk_usage)
+    {
+        std::vector<size_t> new_index(results.usage.size());
+        for (size_t i = 0; i < usage_order.size(); i++)
+        {
+            new_index[usage_order[i]] = i;
+        }
+
+        apply_order(results.usage, usage_order);
+        for (usage_node& node : results.usage)
+        {
+            if (node.parent != SIZE_MAX)
+            {
+                node.parent = new_index[node.parent];
+            }
+        }
+
+        // children always come after their parents, so one reverse pass totals
+        // everything bottom-up
+        for (size_t i = results.usage.size(); i-- > 0; )
+        {
+            if (results.usage[i].parent == SIZE_MAX)
+            {
+                continue;
+            }
+
+            usage_node& parent = results.usage[results.usage[i].parent];
+            parent.files += results.usage[i].files;
+            parent.dirs += results.usage[i].dirs;
+            parent.apparent += results.usage[i].apparent;
+            parent.allocated += results.usage[i].allocated;
+        }
+    }
+
+    std::sort(results.errors.begin(), results.errors.end(), [](const search_error& a, const search_error& b)
+    {
+        const int cmp = a.path.compare(b.path);
+        return cmp != 0 ? cmp < 0 : std::strcmp(a.operation, b.operation) < 0;
+    });
+
+    // each stage below can take a while, so an interrupt stops the search
+    // between (or during) them with whatever was finished
+    auto interrupted = [&]()
+    {
+        if (!cancelled && opts.interrupted && opts.interrupted())
+        {
+            cancelled = true;
+        }
+        results.stats.interrupted = cancelled;
+        return results.stats.interrupted;
+    };
+
+    // sorting first decides which path of a hard-linked file is kept, and then
+    // the contents of each file are only read once (filtering keeps the order)
+    if (opts.sort != sort_key::none && !interrupted())
+    {
+        sort_results(results, opts, cancelled);
+    }
+
+    if (opts.unique_inodes)
+    {
+        remove_repeated_inodes(results);
+    }
+
+    // (this runs even after an interrupt, so files that were never read aren't
+    // left in the results as if they had matched)
+    if (!opts.contains_text.empty() || !opts.contains_regex.empty())
+    {
+        interrupted();
+        filter_contents(results, opts, cancelled);
+    }
+
+    if (opts.hash != hash_kind::none && !interrupted())
+    {
+        hash_results(results, opts, cancelled);
+    }
+    interrupted();
+
+    results.stats.spilled += results.arena.spilled();
+    results.stats.spill_failed = results.stats.spill_failed || results.arena.failed();
+
+    results.stats.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return results;
+}
@@ -0,0 +1,550 @@
+// the search engine behind fsfind: a parallel crawler, plus the sorting,
+// hashing & duplicate finding done on its results.  it has no dependency on
+// MATLAB, and is shared by the MEX function and the fsfind command line tool.
+//
+// Author:     Austin Fite
+// Contact:    akfite@gmail.com
+// Date:       2024
+
+#ifndef FSFIND_ENGINE_H
+#define FSFIND_ENGINE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FSFIND_POSIX 1
+#include <sys/types.h>
+#else
+#define FSFIND_POSIX 0
+#endif
+
+#if defined(__SSE2__)
+#define FSFIND_SSE2 1
+#include <emmintrin.h>
+#else
+#define FSFIND_SSE2 0
+#endif
+
+// AVX2 code is compiled for the target on its own, and only used if the CPU
+// running it has it (so no special compiler flags are needed)
+#if FSFIND_SSE2 && (defined(__GNUC__) || defined(__clang__))
+#define FSFIND_AVX2 1
+#include <immintrin.h>
+#else
+#define FSFIND_AVX2 0
+#endif
+
+namespace fs = std::filesystem;
+
+// ---------------------------------------------------------------------------
+// recursive search
+// ---------------------------------------------------------------------------
+
+enum class hash_kind { none, xxh3, sha256 };
+
+enum class search_mode { list, duplicates, disk_usage };
+
+enum class sort_key { none, name, path, natural, size, mtime };
+
+// running totals of the crawl, as sent to search_options::progress
+struct search_progress
+{
+    uint64_t directories = 0;
+    uint64_t entries = 0;
+    uint64_t matches = 0;
+    size_t queued = 0;          // directories waiting to be listed
+    double elapsed = 0;         // seconds
+};
+
+struct search_options
+{
+    search_mode mode = search_mode::list;
+    std::string pattern = ".*";
+    bool case_sensitive = true;
+    double depth = 1;
+    std::vector<std::string> depthwise_pattern;
+    bool same_filesystem = false;
+    bool skip_pseudo_filesystems = true;
+    std::vector<std::string> exclude;
+    std::vector<std::string> exclude_dirs;
+    bool exclude_regex = false;
+    bool respect_ignore_files = false;
+    std::string contains_text;
+    std::string contains_regex;
+    hash_kind hash = hash_kind::none;
+    double threads = 0;         // 0 = one per hardware thread
+    size_t min_concurrency = 1; // bounds on the number of directories read at once
+    size_t max_concurrency = 64;
+    double timeout = std::numeric_limits<double>::infinity();  // seconds allowed for the crawl
+    std::function<bool(const search_progress&)> progress;  // called while crawling (stops once it returns false)
+    double progress_interval = 1;   // seconds between progress reports
+    std::function<bool()> interrupted;  // polled while searching; true abandons the search
+    double memory_limit = std::numeric_limits<double>::infinity();  // bytes of result paths kept in memory
+    uint64_t min_size = 0;      // smallest file considered by the duplicate finder
+    double report_depth = 1;    // deepest directory reported by the disk usage mode
+    sort_key sort = sort_key::none;
+    bool tree_output = false;   // return a directory table + per-entry index instead of paths
+    bool relative_paths = false;
+    bool raw_names = false;     // return the path bytes untouched instead of strings
+    bool collect_stats = false; // fill search_results::sizes, inodes & mtimes
+    bool collect_links = false; // fill search_results::links
+    bool unique_inodes = false; // return each hard-linked file once (at its first path in the results)
+    bool need_types = true;     // stat every entry for its type (otherwise types are only right for directories)
+    bool error_table = false;   // errors are returned, so they aren't printed
+    bool silent = false;
+};
+
+// what the crawl did, returned to MATLAB as the search info
+struct search_stats
+{
+    uint64_t directories = 0;   // directories listed
+    uint64_t entries = 0;       // entries seen in them (before any filtering)
+    size_t concurrency = 0;     // directories read at once when the crawl finished
+    double elapsed = 0;         // seconds
+    bool timed_out = false;
+    bool interrupted = false;   // by search_options::interrupted (the results are incomplete)
+    uint64_t spilled = 0;       // bytes written to temporary files to stay within the memory limit
+    bool spill_failed = false;  // a temporary file could not be used (so the limit was exceeded)
+};
+
+// a directory the crawl never finished listing (when it ran out of time)
+struct unvisited_dir
+{
+    std::string path;
+    size_t depth;           // of the directory itself, relative to its root
+};
+
+// something the crawl could not do, e.g. open a directory
+struct search_error
+{
+    std::string path;
+    std::error_code ec;
+    const char* operation;      // "opendir", "readdir" or "stat"
+};
+
+// totals for everything beneath a single directory (disk usage mode)
+struct usage_node
+{
+    std::string path;
+    size_t parent;          // index of the parent node (SIZE_MAX for the root)
+    size_t depth;           // 0 for the root
+    uint64_t files = 0;     // every entry that is not a directory
+    uint64_t dirs = 0;
+    uint64_t apparent = 0;
+    uint64_t allocated = 0;
+};
+
+// an anonymous temporary file (removed when closed) for whatever doesn't fit
+// within the memory limit
+class temp_file
+{
+public:
+    uint64_t size() const
+    {
+        return size_;
+    }
+
+    // appends the bytes and returns where they start (or false on failure)
+    bool append(const void* data, size_t n, uint64_t& offset)
+    {
+        if (!file_)
+        {
+            file_.reset(std::tmpfile());
+        }
+        if (!file_ || !seek(size_) || std::fwrite(data, 1, n, file_.get()) != n)
+        {
+            return false;
+        }
+
+        offset = size_;
+        size_ += n;
+        return true;
+    }
+
+    bool read(uint64_t offset, void* data, size_t n) const
+    {
+        return file_ && seek(offset) && std::fread(data, 1, n, file_.get()) == n;
+    }
+
+private:
+    struct closer
+    {
+        void operator()(std::FILE* f) const { std::fclose(f); }
+    };
+
+    bool seek(uint64_t offset) const
+    {
+#if defined(_WIN32)
+        return _fseeki64(file_.get(), static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+        return fseeko(file_.get(), static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    std::unique_ptr<std::FILE, closer> file_;
+    uint64_t size_ = 0;
+};
+
+// result paths are packed back-to-back into large chunks rather than getting a
+// heap allocation each.  with a memory limit, the least recently used chunks
+// are written to a temporary file once the ones in memory exceed it, and are
+// read back whenever one of their paths is needed again.
+class path_arena
+{
+public:
+    // where a stored path lives: a chunk, and an offset within it
+    struct ref
+    {
+        uint32_t chunk;
+        uint32_t offset;
+    };
+
+    // bytes of chunks kept in memory (never fewer than two chunks)
+    void set_limit(double bytes)
+    {
+        limit_ = bytes >= static_cast<double>(std::numeric_limits<uint64_t>::max())
+            ? std::numeric_limits<uint64_t>::max()
+            : std::max(static_cast<uint64_t>(std::max(bytes, 0.0)), 2 * static_cast<uint64_t>(CHUNK_SIZE));
+        evict(SIZE_MAX);
+    }
+
+    // copies the path into the arena, NUL-terminated
+    ref store(std::string_view path)
+    {
+        const size_t n = path.size() + 1;
+
+        // a long path gets a chunk of its own, as big as it needs
+        if (chunks_.empty() || chunks_.back().capacity - used_ < n)
+        {
+            chunks_.emplace_back();
+            chunks_.back().data.reset(new char[std::max(n, CHUNK_SIZE)]);
+            chunks_.back().capacity = std::max(n, CHUNK_SIZE);
+            resident_ += chunks_.back().capacity;
+            touch(chunks_.size() - 1);
+            used_ = 0;
+
+            // the chunk being filled is never written out
+            evict(chunks_.size() - 1);
+        }
+
+        chunk& c = chunks_.back();
+        std::memcpy(c.data.get() + used_, path.data(), n - 1);
+        c.data[used_ + n - 1] = '\0';
+        const ref out = {static_cast<uint32_t>(chunks_.size() - 1), static_cast<uint32_t>(used_)};
+        used_ += n;
+        c.size = used_;
+        return out;
+    }
+
+    // the stored path; once anything has been spilled, this is only valid until
+    // a path from another chunk is requested, and must not be called from
+    // several threads at once (use copy() instead)
+    const char* get(ref r) const
+    {
+        chunk& c = chunks_[r.chunk];
+        if (spilled_ == 0)
+        {
+            return c.data.get() + r.offset;
+        }
+
+        if (!c.data)
+        {
+            load(r.chunk);
+        }
+        touch(r.chunk);
+        return c.data.get() + r.offset;
+    }
+
+    // the stored path as a string; safe to call from several threads
+    std::string copy(ref r) const
+    {
+        if (spilled_ == 0)
+        {
+            return get(r);
+        }
+
+        std::lock_guard<std::mutex> lock(*mutex_);
+        return get(r);
+    }
+
+    // bytes written to the temporary file
+    uint64_t spilled() const
+    {
+        return spilled_;
+    }
+
+    // true if the temporary file could not be written (or read back)
+    bool failed() const
+    {
+        return failed_;
+    }
+
+private:
+    static constexpr size_t CHUNK_SIZE = 1 << 20;
+
+    struct chunk
+    {
+        std::unique_ptr<char[]> data;   // null while it is only on disk
+        size_t capacity = 0;
+        size_t size = 0;                // bytes in use
+        uint64_t offset = UINT64_MAX;   // position in the file, once written
+        uint64_t last_used = 0;
+    };
+
+    void touch(size_t i) const
+    {
+        chunk& c = chunks_[i];
+        lru_.erase(c.last_used);
+        c.last_used = ++clock_;
+        lru_.emplace(c.last_used, i);
+    }
+
+    // drops the least recently used chunks from memory until within the limit
+    void evict(size_t keep) const
+    {
+        for (auto it = lru_.begin(); resident_ > limit_ && it != lru_.end() && !failed_; )
+        {
+            const size_t i = it->second;
+            chunk& c = chunks_[i];
+            if (i == keep || i + 1 == chunks_.size())
+            {
+                ++it;
+                continue;
+            }
+
+            // chunks never change once full, so they are only ever written once
+            if (c.offset == UINT64_MAX)
+            {
+                if (!file_.append(c.data.get(), c.size, c.offset))
+                {
+                    failed_ = true;
+                    break;
+                }
+                spilled_ += c.size;
+            }
+
+            resident_ -= c.capacity;
+            c.data.reset();
+            c.capacity = 0;
+            it = lru_.erase(it);
+        }
+    }
+
+    void load(size_t i) const
+    {
+        chunk& c = chunks_[i];
+        c.data.reset(new char[c.size]);
+        c.capacity = c.size;
+        resident_ += c.capacity;
+
+        if (!file_.read(c.offset, c.data.get(), c.size))
+        {
+            std::memset(c.data.get(), 0, c.size);
+            failed_ = true;
+        }
+        evict(i);
+    }
+
+    // reading a chunk back in moves things around, hence all the "mutable"
+    mutable std::vector<chunk> chunks_;
+    mutable std::map<uint64_t, size_t> lru_;    // last use -> chunk, oldest first
+    mutable temp_file file_;
+    mutable uint64_t clock_ = 0;
+    mutable uint64_t resident_ = 0;
+    mutable uint64_t spilled_ = 0;
+    mutable bool failed_ = false;
+    std::unique_ptr<std::mutex> mutex_ = std::make_unique<std::mutex>();
+    uint64_t limit_ = std::numeric_limits<uint64_t>::max();
+    size_t used_ = CHUNK_SIZE;
+};
+
+struct result_path
+{
+    path_arena::ref where;  // owned by search_results::arena
+    uint32_t length;
+    uint32_t name;          // offset of the filename within the path
+};
+
+// reorders a per-result column; "order" may also drop entries
+template <typename T>
+inline void apply_order(std::vector<T>& column, const std::vector<size_t>& order)
+{
+    if (column.empty())
+    {
+        return;
+    }
+
+    std::vector<T> out;
+    out.reserve(order.size());
+    for (size_t i : order)
+    {
+        out.push_back(std::move(column[i]));
+    }
+    column = std::move(out);
+}
+
+struct search_results
+{
+    path_arena arena;
+    std::vector<result_path> paths;
+    std::vector<uint8_t> types;     // 0 for anything not stat'd (see search_options::need_types)
+    std::vector<uint64_t> lines;    // first matching line (content search only)
+    std::vector<std::string> hashes;
+
+    // only filled when search_options::collect_stats is set
+    std::vector<uint64_t> sizes;
+    std::vector<std::pair<uint64_t, uint64_t>> inodes;  // (dev, ino)
+    std::vector<int64_t> mtimes;    // nanoseconds since the epoch
+
+    // only filled when search_options::collect_links is set
+    std::vector<uint64_t> links;    // number of hard links (0 for anything not stat'd)
+
+    // only filled in disk usage mode (instead of the per-entry vectors)
+    std::vector<usage_node> usage;
+
+    search_stats stats;
+    std::vector<unvisited_dir> unvisited;
+    std::vector<search_error> errors;   // sorted by path
+
+    // leading bytes of each path (its root & separator) that are left out of
+    // the outputs; only filled when relative paths are requested
+    std::vector<uint32_t> prefixes;
+
+    // index of the root each result was found from; only filled when the roots
+    // overlap, so that results found again from another root can be dropped
+    std::vector<uint32_t> root_index;
+
+    // (dev, ino) of each result that is not a directory and has more than one
+    // link, else (0, 0); only filled for search_options::unique_inodes
+    std::vector<std::pair<uint64_t, uint64_t>> linked;
+
+    size_t size() const
+    {
+        return paths.size();
+    }
+
+    // the full path of a result (see path_arena::get for how long it is valid)
+    std::string_view path(size_t i) const
+    {
+        return {arena.get(paths[i].where), paths[i].length};
+    }
+
+    std::string_view filename(size_t i) const
+    {
+        return path(i).substr(paths[i].name);
+    }
+
+    // the path as it is output
+    std::string_view output_path(size_t i) const
+    {
+        return path(i).substr(prefixes.empty() ? 0 : prefixes[i]);
+    }
+
+    // a copy of the full path that is safe to make from several threads
+    std::string path_string(size_t i) const
+    {
+        return arena.copy(paths[i].where);
+    }
+
+    void add(std::string_view path, size_t name_length, uint8_t type)
+    {
+        const uint32_t length = static_cast<uint32_t>(path.size());
+        paths.push_back({arena.store(path), length, length - static_cast<uint32_t>(name_length)});
+        types.push_back(type);
+    }
+
+    // reorders every column so that entry i becomes entry order[i]
+    void permute(const std::vector<size_t>& order)
+    {
+        apply_order(paths, order);
+        apply_order(types, order);
+        apply_order(lines, order);
+        apply_order(hashes, order);
+        apply_order(sizes, order);
+        apply_order(inodes, order);
+        apply_order(mtimes, order);
+        apply_order(links, order);
+        apply_order(prefixes, order);
+        apply_order(root_index, order);
+        apply_order(linked, order);
+    }
+};
+
+// groups of regular files with identical contents (duplicates mode)
+struct duplicate_groups
+{
+    std::vector<std::vector<size_t>> duplicates;    // one result index per distinct inode
+    std::vector<std::vector<size_t>> hard_links;    // every path to the same inode
+    bool interrupted = false;   // by search_options::interrupted (the groups are incomplete)
+};
+
+// the contents of several folders (see list_folders)
+struct folder_listing
+{
+    std::vector<fs::path> paths;
+    std::vector<uint8_t> types;         // empty unless they were asked for
+    std::vector<uint32_t> folder;       // index of the folder each path is in
+    std::vector<search_error> errors;   // the folders that could not be listed
+};
+
+// the unique parent directories of the results, and the index of each result's
+// directory within them
+struct directory_table
+{
+    std::vector<std::string> dirs;
+    std::vector<uint32_t> parent;
+};
+
+// the contents of a single folder (like MATLAB's "dir")
+std::list<fs::path> get_contents(std::string folder, std::error_code& ec);
+
+// lists several folders at once on "threads" threads (0 = one per hardware
+// thread).  the contents are in the order of the folders, and the types are only
+// filled in (with a stat of each path) when they are needed.
+folder_listing list_folders(const std::vector<std::string>& folders, bool need_types, double threads = 0);
+
+// 0 = none, 1 = not found, 2 = file, 3 = directory, 4 = symlink, 5 = block,
+// 6 = character, 7 = fifo, 8 = socket, 9 = unknown
+uint8_t uint8_filetype(fs::file_type type);
+uint8_t uint8_filetype(const fs::path& p);
+
+// searches every root at once.  throws std::regex_error for a bad pattern, and
+// std::invalid_argument for an option this platform can't do.
+search_results search(const std::vector<fs::path>& root_paths, const search_options& opts);
+
+// groups the regular files of the results by their contents
+duplicate_groups find_duplicates(const search_results& results, const search_options& opts);
+
+// the directories of the results (for tree output)
+directory_table build_directory_table(const search_results& results);
+
+#endif // FSFIND_ENGINE_H
@@ -1,111 +1,904 @@
-//   Description: MEX implementation of listing files in a folder.
+//   Description: MEX implementation of listing files in a folder.  The search
+//                itself is done by the engine in fsfind_engine.cpp.
 //
 //   Author:     Austin Fite
 //   Contact:    akfite@gmail.com
 //   Date:       2024
 
-#include <cstdint>
-#include <filesystem>
-#include <list>
-#include <string>
+#include "fsfind_engine.h"
+
+#include <stdexcept>
 
 // mex includes
 #include "mex.h"
 #include "matrix.h"
 
-namespace fs = std::filesystem;
+// undocumented, but exported by libut on every platform (link with -lut)
+extern "C" bool utIsInterruptPending();
+
+// ---------------------------------------------------------------------------
+// UTF-8 -> UTF-16 (MATLAB char) output
+// ---------------------------------------------------------------------------
 
-// lightweight replacement for MATLAB's "dir"
-inline std::list<fs::path> get_contents(std::string folder)
+// widens the leading ASCII bytes of "in" into "out"; returns how many there were
+inline size_t widen_ascii(const char* in, size_t n, mxChar* out)
 {
-    std::list<fs::path> files;
-    for (const auto& entry : fs::directory_iterator(folder))
+    size_t i = 0;
+
+#if FSFIND_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        if (_mm_movemask_epi8(bytes) != 0)
+        {
+            break;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi8(bytes, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpackhi_epi8(bytes, zero));
+    }
+#endif
+
+    for (; i < n && static_cast<unsigned char>(in[i]) < 0x80; i++)
     {
-        files.emplace_back(entry.path());
+        out[i] = static_cast<mxChar>(in[i]);
     }
-    return files;
+    return i;
 }
 
-inline uint8_t uint8_filetype(const fs::path& p)
+#if FSFIND_AVX2
+__attribute__((target("avx2")))
+inline size_t widen_ascii_avx2(const char* in, size_t n, mxChar* out)
 {
-    auto status = fs::status(p);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        if (_mm256_movemask_epi8(bytes) != 0)
+        {
+            break;
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+            _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16),
+            _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)));
+    }
+    return i + widen_ascii(in + i, n - i, out + i);
+}
+#endif
+
+// transcodes UTF-8 to UTF-16 and returns the number of code units written, which
+// is never more than n.  ASCII runs are widened 16 or 32 bytes at a time; other
+// sequences are validated, and each invalid one (a stray byte, or the longest
+// prefix of a truncated sequence) becomes a single U+FFFD.
+inline size_t utf8_to_utf16(const char* in, size_t n, mxChar* out)
+{
+#if FSFIND_AVX2
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+#endif
 
-    switch (status.type())
+    size_t i = 0;
+    size_t o = 0;
+    while (i < n)
     {
-        case fs::file_type::regular:
-            return 2;
-        case fs::file_type::directory:
-            return 3;
-        case fs::file_type::symlink:
-            return 4;
-        case fs::file_type::block:
-            return 5;
-        case fs::file_type::character:
-            return 6;
-        case fs::file_type::fifo:
-            return 7;
-        case fs::file_type::socket:
-            return 8;
-        case fs::file_type::unknown:
-            return 9;
-        case fs::file_type::none:
-            return 0;
-        case fs::file_type::not_found:
-            return 1;
-        default:
-            return 9;
+#if FSFIND_AVX2
+        const size_t ascii = has_avx2
+            ? widen_ascii_avx2(in + i, n - i, out + o)
+            : widen_ascii(in + i, n - i, out + o);
+#else
+        const size_t ascii = widen_ascii(in + i, n - i, out + o);
+#endif
+        i += ascii;
+        o += ascii;
+        if (i == n)
+        {
+            break;
+        }
+
+        const unsigned char lead = static_cast<unsigned char>(in[i]);
+        size_t length = 0;
+        uint32_t code = 0;
+        unsigned char lo = 0x80;    // allowed range of the second byte
+        unsigned char hi = 0xBF;
+
+        if (lead >= 0xC2 && lead <= 0xDF)
+        {
+            length = 2;
+            code = lead & 0x1F;
+        }
+        else if (lead >= 0xE0 && lead <= 0xEF)
+        {
+            length = 3;
+            code = lead & 0x0F;
+            lo = (lead == 0xE0) ? 0xA0 : 0x80;  // no overlong forms
+            hi = (lead == 0xED) ? 0x9F : 0xBF;  // no surrogates
+        }
+        else if (lead >= 0xF0 && lead <= 0xF4)
+        {
+            length = 4;
+            code = lead & 0x07;
+            lo = (lead == 0xF0) ? 0x90 : 0x80;
+            hi = (lead == 0xF4) ? 0x8F : 0xBF;  // nothing past U+10FFFF
+        }
+
+        size_t k = 1;
+        for (; k < length && i + k < n; k++)
+        {
+            const unsigned char next = static_cast<unsigned char>(in[i + k]);
+            if (next < (k == 1 ? lo : 0x80) || next > (k == 1 ? hi : 0xBF))
+            {
+                break;
+            }
+            code = (code << 6) | (next & 0x3F);
+        }
+
+        if (length == 0 || k < length)
+        {
+            out[o++] = 0xFFFD;
+            i += k;
+            continue;
+        }
+
+        i += length;
+        if (code >= 0x10000)
+        {
+            code -= 0x10000;
+            out[o++] = static_cast<mxChar>(0xD800 + (code >> 10));
+            out[o++] = static_cast<mxChar>(0xDC00 + (code & 0x3FF));
+        }
+        else
+        {
+            out[o++] = static_cast<mxChar>(code);
+        }
     }
+    return o;
 }
 
-// MATLAB gateway 
-void mexFunction(int nargout, mxArray *outputs[], int nargin, const mxArray *inputs[])
+// replaces mxCreateString for paths: that converts one character at a time
+// through the session's locale, while paths are (almost always) UTF-8 anyway.
+// elsewhere they are in the ANSI code page, which mxCreateString does handle.
+inline mxArray* create_path_string(std::string_view path)
+{
+#if FSFIND_POSIX
+    thread_local std::vector<mxChar> buffer;
+    buffer.resize(path.size());
+    const size_t n = utf8_to_utf16(path.data(), path.size(), buffer.data());
+
+    mwSize dims[2] = {n == 0 ? 0u : 1u, n};
+    mxArray* out = mxCreateCharArray(2, dims);
+    std::memcpy(mxGetChars(out), buffer.data(), n * sizeof(mxChar));
+    return out;
+#else
+    return mxCreateString(std::string(path).c_str());
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// helpers for reading the options struct passed in by fsfind
+// ---------------------------------------------------------------------------
+
+inline const mxArray* get_option(const mxArray* opts, const char* name)
 {
-    if (nargin != 1)
+    const mxArray* value = mxGetField(opts, 0, name);
+    return (value == nullptr || mxIsEmpty(value)) ? nullptr : value;
+}
+
+inline bool get_logical_option(const mxArray* opts, const char* name, bool fallback)
+{
+    const mxArray* value = get_option(opts, name);
+    return value ? mxGetScalar(value) != 0 : fallback;
+}
+
+inline double get_double_option(const mxArray* opts, const char* name, double fallback)
+{
+    const mxArray* value = get_option(opts, name);
+    return value ? mxGetScalar(value) : fallback;
+}
+
+inline std::string to_string(const mxArray* value, const char* name)
+{
+    if (!mxIsChar(value))
     {
-        mexErrMsgTxt("Incorrect number of input arguments (expected 1).");
-        // exit
+        mexErrMsgIdAndTxt("fsfind:bad_option", "Option '%s' must be a character vector.", name);
     }
 
-    if (nargout > 3)
+    char* str = mxArrayToString(value);
+    std::string out(str);
+    mxFree(str);
+    return out;
+}
+
+inline std::string get_string_option(const mxArray* opts, const char* name, const std::string& fallback)
+{
+    const mxArray* value = get_option(opts, name);
+    return value ? to_string(value, name) : fallback;
+}
+
+inline std::vector<std::string> get_string_list_option(const mxArray* opts, const char* name)
+{
+    std::vector<std::string> out;
+    const mxArray* value = get_option(opts, name);
+
+    if (value == nullptr)
     {
-        mexErrMsgTxt("Incorrect number of output arguments (expected <= 3).");
-        // exit
+        return out;
+    }
+    if (!mxIsCell(value))
+    {
+        mexErrMsgIdAndTxt("fsfind:bad_option", "Option '%s' must be a cell array of character vectors.", name);
+    }
+
+    for (size_t i = 0; i < mxGetNumberOfElements(value); i++)
+    {
+        const mxArray* cell = mxGetCell(value, i);
+        out.emplace_back((cell == nullptr || mxIsEmpty(cell)) ? std::string() : to_string(cell, name));
+    }
+    return out;
+}
+
+// sends a progress report to the callback, or prints it; returns false if the
+// callback failed (and should not be called again)
+inline bool report_progress(const mxArray* callback, const search_progress& progress)
+{
+    if (callback == nullptr)
+    {
+        mexPrintf("fsfind: %llu directories, %llu entries, %llu matches, %llu queued (%.1f s)\n",
+            static_cast<unsigned long long>(progress.directories),
+            static_cast<unsigned long long>(progress.entries),
+            static_cast<unsigned long long>(progress.matches),
+            static_cast<unsigned long long>(progress.queued), progress.elapsed);
+        mexEvalString("drawnow;");
+        return true;
+    }
+
+    const char* fields[] = {"Directories", "Entries", "Matches", "Queued", "ElapsedSeconds"};
+    mxArray* info = mxCreateStructMatrix(1, 1, 5, fields);
+    mxSetField(info, 0, fields[0], mxCreateDoubleScalar(static_cast<double>(progress.directories)));
+    mxSetField(info, 0, fields[1], mxCreateDoubleScalar(static_cast<double>(progress.entries)));
+    mxSetField(info, 0, fields[2], mxCreateDoubleScalar(static_cast<double>(progress.matches)));
+    mxSetField(info, 0, fields[3], mxCreateDoubleScalar(static_cast<double>(progress.queued)));
+    mxSetField(info, 0, fields[4], mxCreateDoubleScalar(progress.elapsed));
+
+    // an error can't be allowed to unwind through the running workers
+    mxArray* args[] = {const_cast<mxArray*>(callback), info};
+    mxArray* err = mexCallMATLABWithTrap(0, nullptr, 2, args, "feval");
+    mxDestroyArray(info);
+
+    if (err != nullptr)
+    {
+        mxDestroyArray(err);
+        mexWarnMsgIdAndTxt("fsfind:progress_failed",
+            "The 'Progress' callback failed; no more progress will be reported.");
+        return false;
+    }
+    return true;
+}
+
+inline search_options parse_search_options(const mxArray* opts)
+{
+    search_options out;
+
+    const std::string mode = get_string_option(opts, "Mode", "list");
+    if (mode == "duplicates")
+    {
+        out.mode = search_mode::duplicates;
+        out.collect_stats = true;
+    }
+    else if (mode == "du")
+    {
+        out.mode = search_mode::disk_usage;
+    }
+    else if (mode != "list")
+    {
+        mexErrMsgIdAndTxt("fsfind:bad_option", "Unknown mode '%s' (expected 'list', 'duplicates' or 'du').", mode.c_str());
+    }
+
+    out.pattern = get_string_option(opts, "Pattern", out.pattern);
+    out.case_sensitive = get_logical_option(opts, "CaseSensitive", out.case_sensitive);
+    out.depth = get_double_option(opts, "Depth", out.depth);
+    out.depthwise_pattern = get_string_list_option(opts, "DepthwisePattern");
+    out.same_filesystem = get_logical_option(opts, "SameFilesystem", out.same_filesystem);
+    out.skip_pseudo_filesystems = get_logical_option(opts, "SkipPseudoFilesystems", out.skip_pseudo_filesystems);
+    out.exclude = get_string_list_option(opts, "Exclude");
+    out.exclude_dirs = get_string_list_option(opts, "ExcludeDirs");
+    out.exclude_regex = get_string_option(opts, "ExcludeSyntax", "glob") == "regex";
+    out.respect_ignore_files = get_logical_option(opts, "RespectIgnoreFiles", out.respect_ignore_files);
+    out.contains_text = get_string_option(opts, "ContainsText", out.contains_text);
+    out.contains_regex = get_string_option(opts, "ContainsRegex", out.contains_regex);
+    out.threads = get_double_option(opts, "Threads", out.threads);
+    out.timeout = get_double_option(opts, "Timeout", out.timeout);
+    out.progress_interval = get_double_option(opts, "ProgressInterval", out.progress_interval);
+    out.memory_limit = get_double_option(opts, "MemoryLimit", out.memory_limit);
+
+    // true to print progress, or a function handle to send it to
+    if (const mxArray* value = get_option(opts, "Progress"))
+    {
+        if (mxIsFunctionHandle(value))
+        {
+            out.progress = [value](const search_progress& progress)
+            {
+                return report_progress(value, progress);
+            };
+        }
+        else if (mxGetScalar(value) != 0)
+        {
+            out.progress = [](const search_progress& progress)
+            {
+                return report_progress(nullptr, progress);
+            };
+        }
+    }
+
+    out.interrupted = utIsInterruptPending;
+
+    // [min max], or a single value for a fixed number of readers
+    if (const mxArray* value = get_option(opts, "Concurrency"))
+    {
+        const size_t n = mxGetNumberOfElements(value);
+        const double* bounds = mxIsDouble(value) ? mxGetDoubles(value) : nullptr;
+
+        // (Inf or NaN can't be converted to a count)
+        if (bounds == nullptr || n < 1 || n > 2 || !std::isfinite(bounds[0]) || !std::isfinite(bounds[n-1])
+            || bounds[0] < 1 || bounds[n-1] < bounds[0])
+        {
+            mexErrMsgIdAndTxt("fsfind:bad_option",
+                "Option 'Concurrency' must be a scalar or a [min max] pair of finite values with 1 <= min <= max.");
+        }
+
+        out.min_concurrency = static_cast<size_t>(bounds[0]);
+        out.max_concurrency = static_cast<size_t>(bounds[n-1]);
+    }
+    out.min_size = static_cast<uint64_t>(get_double_option(opts, "MinSize", 0));
+    out.report_depth = get_double_option(opts, "ReportDepth", out.report_depth);
+
+    const std::string sort = get_string_option(opts, "Sort", "none");
+    const char* sort_names[] = {"none", "name", "path", "natural", "size", "mtime"};
+    const auto sort_name = std::find(std::begin(sort_names), std::end(sort_names), sort);
+    if (sort_name == std::end(sort_names))
+    {
+        mexErrMsgIdAndTxt("fsfind:bad_option",
+            "Unknown sort '%s' (expected 'none', 'name', 'path', 'natural', 'size' or 'mtime').", sort.c_str());
     }
-    
-    if (!mxIsChar(inputs[0]))
+    out.sort = static_cast<sort_key>(sort_name - std::begin(sort_names));
+    if (out.sort == sort_key::size || out.sort == sort_key::mtime)
     {
-        mexErrMsgTxt("The input folder must be a character vector.");
+        out.collect_stats = true;
     }
 
-    const std::string folder = std::string(mxArrayToString(inputs[0]));
-    
-    // list everything in current folder
-    const std::list<fs::path> paths = get_contents(folder);
+    const std::string output = get_string_option(opts, "Output", "paths");
+    if (output != "paths" && output != "tree")
+    {
+        mexErrMsgIdAndTxt("fsfind:bad_option", "Unknown output '%s' (expected 'paths' or 'tree').", output.c_str());
+    }
+    out.tree_output = (output == "tree");
+    out.relative_paths = get_logical_option(opts, "RelativePaths", out.relative_paths);
+    out.raw_names = get_logical_option(opts, "RawNames", out.raw_names);
+    out.unique_inodes = get_logical_option(opts, "UniqueInodes", out.unique_inodes);
+    if (out.raw_names && out.tree_output)
+    {
+        mexErrMsgIdAndTxt("fsfind:bad_option", "Options 'RawNames' and 'Output','tree' cannot be combined.");
+    }
 
+    const std::string hash = get_string_option(opts, "Hash", "none");
+    if (hash == "xxh3")
+    {
+        out.hash = hash_kind::xxh3;
+    }
+    else if (hash == "sha256")
+    {
+        out.hash = hash_kind::sha256;
+    }
+    else if (hash != "none")
+    {
+        mexErrMsgIdAndTxt("fsfind:bad_option", "Unknown hash '%s' (expected 'none', 'xxh3' or 'sha256').", hash.c_str());
+    }
+
+    out.silent = get_logical_option(opts, "Silent", out.silent);
+    return out;
+}
+
+// Mx1 cell array of Nx1 cell arrays of paths
+inline mxArray* path_groups_to_cell(const search_results& results, const std::vector<std::vector<size_t>>& groups)
+{
+    mxArray* out = mxCreateCellMatrix(groups.size(), 1);
+
+    for (mwIndex g = 0; g < groups.size(); g++)
+    {
+        mxArray* paths = mxCreateCellMatrix(groups[g].size(), 1);
+        for (mwIndex i = 0; i < groups[g].size(); i++)
+        {
+            mxSetCell(paths, i, create_path_string(results.path_string(groups[g][i])));
+        }
+        mxSetCell(out, g, paths);
+    }
+
+    return out;
+}
+
+// 1x1 struct of Nx1 columns, one row per reported directory
+inline mxArray* usage_to_struct(const std::vector<usage_node>& usage)
+{
+    const char* fields[] = {"Path", "Depth", "Files", "Directories", "ApparentBytes", "AllocatedBytes"};
+    mxArray* out = mxCreateStructMatrix(1, 1, 6, fields);
+
+    const size_t N = usage.size();
+    mxArray* path = mxCreateCellMatrix(N, 1);
+    mxArray* columns[5];
+    for (size_t c = 0; c < 5; c++)
+    {
+        columns[c] = mxCreateNumericMatrix(N, 1, mxDOUBLE_CLASS, mxREAL);
+    }
+
+    for (mwIndex i = 0; i < N; i++)
+    {
+        mxSetCell(path, i, create_path_string(usage[i].path));
+        mxGetDoubles(columns[0])[i] = static_cast<double>(usage[i].depth);
+        mxGetDoubles(columns[1])[i] = static_cast<double>(usage[i].files);
+        mxGetDoubles(columns[2])[i] = static_cast<double>(usage[i].dirs);
+        mxGetDoubles(columns[3])[i] = static_cast<double>(usage[i].apparent);
+        mxGetDoubles(columns[4])[i] = static_cast<double>(usage[i].allocated);
+    }
+
+    mxSetField(out, 0, fields[0], path);
+    for (size_t c = 0; c < 5; c++)
+    {
+        mxSetField(out, 0, fields[c+1], columns[c]);
+    }
+    return out;
+}
+
+// 1x1 struct with the unique directories (Dx1 cell) and the 1-based index of
+// each result's directory (Nx1 uint32)
+inline mxArray* tree_to_struct(const search_results& results)
+{
+    const directory_table table = build_directory_table(results);
+
+    const char* fields[] = {"Directory", "Parent"};
+    mxArray* out = mxCreateStructMatrix(1, 1, 2, fields);
+
+    mxArray* dirs = mxCreateCellMatrix(table.dirs.size(), 1);
+    for (mwIndex i = 0; i < table.dirs.size(); i++)
+    {
+        mxSetCell(dirs, i, create_path_string(table.dirs[i]));
+    }
+
+    mxArray* parent = mxCreateNumericMatrix(table.parent.size(), 1, mxUINT32_CLASS, mxREAL);
+    uint32_t* p_parent = mxGetUint32s(parent);
+    for (size_t i = 0; i < table.parent.size(); i++)
+    {
+        p_parent[i] = table.parent[i] + 1;
+    }
+
+    mxSetField(out, 0, fields[0], dirs);
+    mxSetField(out, 0, fields[1], parent);
+    return out;
+}
+
+// 1x1 struct with every output path back-to-back, exactly as the filesystem
+// gave them (no transcoding), the 0-based offset of each path within them plus
+// one past the last ((N+1)x1), and the offset of each filename (Nx1)
+inline mxArray* raw_paths_to_struct(const search_results& results)
+{
+    const size_t N = results.size();
+    auto prefix = [&](size_t i) -> size_t { return results.prefixes.empty() ? 0 : results.prefixes[i]; };
+
+    size_t total = 0;
+    for (size_t i = 0; i < N; i++)
+    {
+        total += results.paths[i].length - prefix(i);
+    }
+
+    const char* fields[] = {"Bytes", "Offsets", "NameOffsets"};
+    mxArray* out = mxCreateStructMatrix(1, 1, 3, fields);
+    mxArray* bytes = mxCreateUninitNumericMatrix(total, 1, mxUINT8_CLASS, mxREAL);
+    mxArray* offsets = mxCreateUninitNumericMatrix(N + 1, 1, mxDOUBLE_CLASS, mxREAL);
+    mxArray* names = mxCreateUninitNumericMatrix(N, 1, mxDOUBLE_CLASS, mxREAL);
+
+    uint8_t* p_bytes = mxGetUint8s(bytes);
+    double* p_offsets = mxGetDoubles(offsets);
+    double* p_names = mxGetDoubles(names);
+
+    size_t at = 0;
+    for (size_t i = 0; i < N; i++)
+    {
+        const std::string_view path = results.output_path(i);
+        std::memcpy(p_bytes + at, path.data(), path.size());
+        p_offsets[i] = static_cast<double>(at);
+        p_names[i] = static_cast<double>(at + results.paths[i].name - prefix(i));
+        at += path.size();
+    }
+    p_offsets[N] = static_cast<double>(at);
+
+    mxSetField(out, 0, fields[0], bytes);
+    mxSetField(out, 0, fields[1], offsets);
+    mxSetField(out, 0, fields[2], names);
+    return out;
+}
+
+// 1x1 struct describing how the search went
+inline mxArray* stats_to_struct(const search_results& results)
+{
+    const search_stats& stats = results.stats;
+
+    const char* fields[] = {"Directories", "Entries", "Concurrency", "ElapsedSeconds",
+        "TimedOut", "Unvisited", "UnvisitedDepth", "SpilledBytes"};
+    mxArray* out = mxCreateStructMatrix(1, 1, 8, fields);
+
+    mxSetField(out, 0, fields[0], mxCreateDoubleScalar(static_cast<double>(stats.directories)));
+    mxSetField(out, 0, fields[1], mxCreateDoubleScalar(static_cast<double>(stats.entries)));
+    mxSetField(out, 0, fields[2], mxCreateDoubleScalar(static_cast<double>(stats.concurrency)));
+    mxSetField(out, 0, fields[3], mxCreateDoubleScalar(stats.elapsed));
+    mxSetField(out, 0, fields[4], mxCreateLogicalScalar(stats.timed_out));
+
+    const size_t N = results.unvisited.size();
+    mxArray* paths = mxCreateCellMatrix(N, 1);
+    mxArray* depths = mxCreateNumericMatrix(N, 1, mxDOUBLE_CLASS, mxREAL);
+    for (mwIndex i = 0; i < N; i++)
+    {
+        mxSetCell(paths, i, create_path_string(results.unvisited[i].path));
+        mxGetDoubles(depths)[i] = static_cast<double>(results.unvisited[i].depth);
+    }
+    mxSetField(out, 0, fields[5], paths);
+    mxSetField(out, 0, fields[6], depths);
+    mxSetField(out, 0, fields[7], mxCreateDoubleScalar(static_cast<double>(stats.spilled)));
+    return out;
+}
+
+// 1x1 struct of Nx1 columns, one row per error
+inline mxArray* errors_to_struct(const std::vector<search_error>& errors)
+{
+    const size_t N = errors.size();
+    const char* fields[] = {"Path", "Errno", "Operation"};
+    mxArray* out = mxCreateStructMatrix(1, 1, 3, fields);
+
+    mxArray* paths = mxCreateCellMatrix(N, 1);
+    mxArray* codes = mxCreateNumericMatrix(N, 1, mxDOUBLE_CLASS, mxREAL);
+    mxArray* operations = mxCreateCellMatrix(N, 1);
+    for (mwIndex i = 0; i < N; i++)
+    {
+        mxSetCell(paths, i, create_path_string(errors[i].path));
+        mxGetDoubles(codes)[i] = static_cast<double>(errors[i].ec.value());
+        mxSetCell(operations, i, mxCreateString(errors[i].operation));
+    }
+
+    mxSetField(out, 0, fields[0], paths);
+    mxSetField(out, 0, fields[1], codes);
+    mxSetField(out, 0, fields[2], operations);
+    return out;
+}
+
+// the paths, names & types outputs of a search, with only the requested ones
+// made (so a single output never converts a name).  which ones is decided once
+// per call, by choosing the specialization.
+template <bool Names, bool Types>
+inline void list_to_outputs(const search_results& results, const search_options& opts, mxArray* outputs[])
+{
+    const size_t N = results.size();
+    mxArray* out_filepaths = nullptr;
+    mxArray* out_filenames = nullptr;
+    if (opts.raw_names)
+    {
+        // the names are within the paths struct
+        out_filepaths = raw_paths_to_struct(results);
+        if constexpr (Names)
+        {
+            out_filenames = mxCreateCellMatrix(0, 1);
+        }
+    }
+    else
+    {
+        out_filepaths = opts.tree_output ? tree_to_struct(results) : mxCreateCellMatrix(N, 1);
+        if constexpr (Names)
+        {
+            out_filenames = mxCreateCellMatrix(N, 1);
+        }
+
+        for (mwIndex i = 0; i < N; i++)
+        {
+            if (!opts.tree_output)
+            {
+                mxSetCell(out_filepaths, i, create_path_string(results.output_path(i)));
+            }
+            if constexpr (Names)
+            {
+                mxSetCell(out_filenames, i, create_path_string(results.filename(i)));
+            }
+        }
+    }
+
+    outputs[0] = out_filepaths;
+    if constexpr (Names)
+    {
+        outputs[1] = out_filenames;
+    }
+
+    if constexpr (Types)
+    {
+        mxArray* out_type = mxCreateUninitNumericMatrix(N, 1, mxUINT8_CLASS, mxREAL);
+        std::copy(results.types.begin(), results.types.end(), mxGetUint8s(out_type));
+        outputs[2] = out_type;
+    }
+}
+
+// the input folders: a character vector, or a cell array of them
+inline std::vector<std::string> get_folders(const mxArray* input)
+{
+    const bool is_list = mxIsCell(input);
+    const size_t n = is_list ? mxGetNumberOfElements(input) : 1;
+
+    std::vector<std::string> folders;
+    folders.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        const mxArray* folder = is_list ? mxGetCell(input, i) : input;
+        if (folder == nullptr || !mxIsChar(folder))
+        {
+            mexErrMsgTxt("The input folders must be character vectors.");
+        }
+
+        char* str = mxArrayToString(folder);
+        folders.emplace_back(str);
+        mxFree(str);
+    }
+    return folders;
+}
+
+// the same for the contents of folders (where each type is a stat)
+template <bool Names, bool Types>
+inline void folder_to_outputs(const folder_listing& listing, mxArray* outputs[])
+{
     // place filepaths & names into a cell array for output
-    size_t N = paths.size();
+    size_t N = listing.paths.size();
     mxArray* out_filepaths = mxCreateCellMatrix(N, 1);
-    mxArray* out_filenames = mxCreateCellMatrix(N, 1);
-    // outut file type array
-    mwSize dims[2] = {N, 1};
-    mxArray* out_type = mxCreateNumericArray(2, dims, mxUINT8_CLASS, mxREAL);
-    uint8_t* p_out_type = mxGetUint8s(out_type);
+    mxArray* out_filenames = Names ? mxCreateCellMatrix(N, 1) : nullptr;
+    mxArray* out_type = Types ? mxCreateUninitNumericMatrix(N, 1, mxUINT8_CLASS, mxREAL) : nullptr;
 
     // keep track of numeric index as we range-based loop over paths
     mwIndex i = 0;
 
     // copy to outputs
-    for (fs::path p : paths)
+    for (const fs::path& p : listing.paths)
     {
-        const std::string fullpath = p.string();
-        mxSetCell(out_filepaths, i, mxCreateString(fullpath.c_str()));
-        mxSetCell(out_filenames, i, mxCreateString(p.filename().string().c_str()));
-        p_out_type[i] = uint8_filetype(p);
+        mxSetCell(out_filepaths, i, create_path_string(p.string()));
+        if constexpr (Names)
+        {
+            mxSetCell(out_filenames, i, create_path_string(p.filename().string()));
+        }
 
         i++;
     }
 
+    if constexpr (Types)
+    {
+        std::copy(listing.types.begin(), listing.types.end(), mxGetUint8s(out_type));
+    }
+
     outputs[0] = out_filepaths;
-    outputs[1] = out_filenames;
-    outputs[2] = out_type;
+    if constexpr (Names)
+    {
+        outputs[1] = out_filenames;
+    }
+    if constexpr (Types)
+    {
+        outputs[2] = out_type;
+    }
+}
+
+// workers can't talk to MATLAB, so problems are only reported once the search
+// is over (unless they are returned instead, which is much faster when there
+// are lots)
+inline void report_problems(const search_results& results, const search_options& opts)
+{
+    if (opts.silent)
+    {
+        return;
+    }
+
+    if (!opts.error_table)
+    {
+        for (const search_error& err : results.errors)
+        {
+            // entries that could not be examined were never reported
+            if (std::strcmp(err.operation, "stat") == 0)
+            {
+                continue;
+            }
+
+            if (err.ec == std::errc::permission_denied)
+            {
+                mexPrintf("Permission denied: %s\n", err.path.c_str());
+            }
+            else
+            {
+                mexWarnMsgIdAndTxt("fsfind:listing_failed",
+                    "%s\nThis will prevent finding any results under %s",
+                    err.ec.message().c_str(), err.path.c_str());
+            }
+        }
+    }
+
+    if (results.stats.spill_failed)
+    {
+        mexWarnMsgIdAndTxt("fsfind:spill_failed",
+            "A temporary file could not be used, so 'MemoryLimit' was exceeded.");
+    }
+}
+
+// MATLAB gateway
+void mexFunction(int nargout, mxArray *outputs[], int nargin, const mxArray *inputs[])
+{
+    if (nargin != 1 && nargin != 2)
+    {
+        mexErrMsgTxt("Incorrect number of input arguments (expected 1 or 2).");
+        // exit
+    }
+
+    if (nargout > 8 || (nargin == 1 && nargout > 4))
+    {
+        mexErrMsgTxt("Incorrect number of output arguments (expected <= 4, or <= 8 when searching).");
+        // exit
+    }
+
+    // a single folder, or a cell array of folders
+    const bool is_list = mxIsCell(inputs[0]);
+    const std::vector<std::string> folders = get_folders(inputs[0]);
+
+    if (nargin == 2)
+    {
+        if (!mxIsStruct(inputs[1]))
+        {
+            mexErrMsgTxt("The search options must be a struct.");
+        }
+
+        // the folders are searched together
+        const std::vector<fs::path> roots(folders.begin(), folders.end());
+
+        search_options opts = parse_search_options(inputs[1]);
+        opts.need_types = (nargout > 2);
+        opts.error_table = (nargout > 6);
+        opts.collect_links = (nargout > 7);
+
+        search_results results;
+        try
+        {
+            results = search(roots, opts);
+        }
+        catch (const std::regex_error& err)
+        {
+            mexErrMsgIdAndTxt("fsfind:bad_pattern", "Invalid regular expression: %s", err.what());
+        }
+        catch (const std::invalid_argument& err)
+        {
+            mexErrMsgIdAndTxt("fsfind:not_supported", "%s", err.what());
+        }
+
+        if (results.stats.interrupted)
+        {
+            // free everything before leaving (mexErrMsgIdAndTxt never returns)
+            results = search_results();
+            mexErrMsgIdAndTxt("fsfind:interrupted", "Search interrupted by user.");
+        }
+
+        report_problems(results, opts);
+
+        if (opts.mode == search_mode::duplicates)
+        {
+            duplicate_groups groups = find_duplicates(results, opts);
+            if (groups.interrupted)
+            {
+                groups = duplicate_groups();
+                results = search_results();
+                mexErrMsgIdAndTxt("fsfind:interrupted", "Search interrupted by user.");
+            }
+            outputs[0] = path_groups_to_cell(results, groups.duplicates);
+            outputs[1] = path_groups_to_cell(results, groups.hard_links);
+            return;
+        }
+
+        if (opts.mode == search_mode::disk_usage)
+        {
+            outputs[0] = usage_to_struct(results.usage);
+            return;
+        }
+
+        if (nargout > 2)
+        {
+            list_to_outputs<true, true>(results, opts, outputs);
+        }
+        else if (nargout > 1)
+        {
+            list_to_outputs<true, false>(results, opts, outputs);
+        }
+        else
+        {
+            list_to_outputs<false, false>(results, opts, outputs);
+        }
+
+        size_t N = results.size();
+        mwSize dims[2] = {N, 1};
+
+        // line of the first content match (NaN when no content filter was used)
+        if (nargout > 3)
+        {
+            mxArray* out_lines = mxCreateNumericArray(2, dims, mxDOUBLE_CLASS, mxREAL);
+            double* p_out_lines = mxGetDoubles(out_lines);
+            for (mwIndex i = 0; i < N; i++)
+            {
+                p_out_lines[i] = results.lines.empty()
+                    ? mxGetNaN() : static_cast<double>(results.lines[i]);
+            }
+            outputs[3] = out_lines;
+        }
+
+        // hex digests of regular files (empty when not hashed)
+        if (nargout > 4)
+        {
+            mxArray* out_hashes = mxCreateCellMatrix(N, 1);
+            for (mwIndex i = 0; i < N; i++)
+            {
+                mxSetCell(out_hashes, i, mxCreateString(
+                    results.hashes.empty() ? "" : results.hashes[i].c_str()));
+            }
+            outputs[4] = out_hashes;
+        }
+
+        if (nargout > 5)
+        {
+            outputs[5] = stats_to_struct(results);
+        }
+
+        if (nargout > 6)
+        {
+            outputs[6] = errors_to_struct(results.errors);
+        }
+
+        // number of hard links to each result
+        if (nargout > 7)
+        {
+            mxArray* out_links = mxCreateUninitNumericMatrix(N, 1, mxDOUBLE_CLASS, mxREAL);
+            std::copy(results.links.begin(), results.links.end(), mxGetDoubles(out_links));
+            outputs[7] = out_links;
+        }
+        return;
+    }
+
+    // list everything in each folder (a list of them is listed in parallel)
+    const folder_listing listing = list_folders(folders, nargout > 2, is_list ? 0 : 1);
+    if (!listing.errors.empty())
+    {
+        const search_error& err = listing.errors.front();
+        if (!is_list)
+        {
+            mexErrMsgIdAndTxt("fsfind:listing_failed", "%s: %s", err.path.c_str(), err.ec.message().c_str());
+        }
+
+        // one missing folder shouldn't lose the contents of all the others
+        mexWarnMsgIdAndTxt("fsfind:listing_failed", "%zu of %zu folders could not be listed (%s: %s)",
+            listing.errors.size(), folders.size(), err.path.c_str(), err.ec.message().c_str());
+    }
+
+    if (nargout > 2)
+    {
+        folder_to_outputs<true, true>(listing, outputs);
+    }
+    else if (nargout > 1)
+    {
+        folder_to_outputs<true, false>(listing, outputs);
+    }
+    else
+    {
+        folder_to_outputs<false, false>(listing, outputs);
+    }
+
+    // the (1-based) index of the folder each path was found in
+    if (nargout > 3)
+    {
+        mxArray* out_folder = mxCreateUninitNumericMatrix(listing.folder.size(), 1, mxDOUBLE_CLASS, mxREAL);
+        double* p_out_folder = mxGetDoubles(out_folder);
+        for (size_t i = 0; i < listing.folder.size(); i++)
+        {
+            p_out_folder[i] = listing.folder[i] + 1.0;
+        }
+        outputs[3] = out_folder;
+    }
 }
@@ -0,0 +1,293 @@
+// Description: minimal stand-in for MATLAB's matrix.h, so that the MEX gateway
+//              can be built & tested without MATLAB.  only the parts of the
+//              C Matrix API used by mex_listfiles.cpp are provided.
+//
+// Author:     Austin Fite
+// Contact:    akfite@gmail.com
+// Date:       2024
+
+#ifndef FSFIND_SHIM_MATRIX_H
+#define FSFIND_SHIM_MATRIX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+typedef size_t mwSize;
+typedef size_t mwIndex;
+typedef char16_t mxChar;
+typedef bool mxLogical;
+
+enum mxClassID
+{
+    mxUNKNOWN_CLASS,
+    mxCELL_CLASS,
+    mxSTRUCT_CLASS,
+    mxLOGICAL_CLASS,
+    mxCHAR_CLASS,
+    mxDOUBLE_CLASS,
+    mxUINT8_CLASS,
+    mxUINT32_CLASS,
+    mxFUNCTION_CLASS
+};
+
+enum mxComplexity { mxREAL, mxCOMPLEX };
+
+// every array is a column-major block of bytes, or of child arrays for cells
+// and structs (which own them)
+struct mxArray
+{
+    mxClassID id = mxUNKNOWN_CLASS;
+    size_t m = 0;
+    size_t n = 0;
+    std::vector<unsigned char> data;
+    std::vector<mxArray*> children;
+    std::vector<std::string> fields;
+
+    ~mxArray()
+    {
+        for (mxArray* child : children)
+        {
+            delete child;
+        }
+    }
+};
+
+inline size_t mxShimElementSize(mxClassID id)
+{
+    switch (id)
+    {
+        case mxDOUBLE_CLASS:
+            return sizeof(double);
+        case mxUINT32_CLASS:
+            return sizeof(uint32_t);
+        case mxCHAR_CLASS:
+            return sizeof(mxChar);
+        default:
+            return 1;
+    }
+}
+
+inline mxArray* mxShimCreate(mxClassID id, size_t m, size_t n)
+{
+    mxArray* a = new mxArray;
+    a->id = id;
+    a->m = m;
+    a->n = n;
+    a->data.resize(m * n * mxShimElementSize(id));
+    return a;
+}
+
+// creation
+
+inline mxArray* mxCreateNumericArray(mwSize, const mwSize* dims, mxClassID id, mxComplexity)
+{
+    return mxShimCreate(id, dims[0], dims[1]);
+}
+
+inline mxArray* mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID id, mxComplexity)
+{
+    return mxShimCreate(id, m, n);
+}
+
+inline mxArray* mxCreateUninitNumericMatrix(mwSize m, mwSize n, mxClassID id, mxComplexity complexity)
+{
+    return mxCreateNumericMatrix(m, n, id, complexity);
+}
+
+inline mxArray* mxCreateDoubleScalar(double value)
+{
+    mxArray* a = mxShimCreate(mxDOUBLE_CLASS, 1, 1);
+    std::memcpy(a->data.data(), &value, sizeof(value));
+    return a;
+}
+
+inline mxArray* mxCreateLogicalScalar(bool value)
+{
+    mxArray* a = mxShimCreate(mxLOGICAL_CLASS, 1, 1);
+    a->data[0] = value;
+    return a;
+}
+
+inline mxArray* mxCreateCharArray(mwSize, const mwSize* dims)
+{
+    return mxShimCreate(mxCHAR_CLASS, dims[0], dims[1]);
+}
+
+// the string is taken as Latin-1 (which is what MATLAB does for ASCII anyway)
+inline mxArray* mxCreateString(const char* str)
+{
+    const size_t n = std::strlen(str);
+    mxArray* a = mxShimCreate(mxCHAR_CLASS, n == 0 ? 0 : 1, n);
+    for (size_t i = 0; i < n; i++)
+    {
+        const mxChar c = static_cast<unsigned char>(str[i]);
+        std::memcpy(a->data.data() + i * sizeof(mxChar), &c, sizeof(mxChar));
+    }
+    return a;
+}
+
+inline mxArray* mxCreateCellMatrix(mwSize m, mwSize n)
+{
+    mxArray* a = mxShimCreate(mxCELL_CLASS, m, n);
+    a->children.resize(m * n, nullptr);
+    return a;
+}
+
+inline mxArray* mxCreateStructMatrix(mwSize m, mwSize n, int nfields, const char** fieldnames)
+{
+    mxArray* a = mxShimCreate(mxSTRUCT_CLASS, m, n);
+    a->fields.assign(fieldnames, fieldnames + nfields);
+    a->children.resize(m * n * nfields, nullptr);
+    return a;
+}
+
+inline void mxDestroyArray(mxArray* a)
+{
+    delete a;
+}
+
+// cells & structs
+
+inline mxArray* mxGetCell(const mxArray* a, mwIndex i)
+{
+    return a->children.at(i);
+}
+
+inline void mxSetCell(mxArray* a, mwIndex i, mxArray* value)
+{
+    delete a->children.at(i);
+    a->children.at(i) = value;
+}
+
+inline int mxGetFieldNumber(const mxArray* a, const char* name)
+{
+    for (size_t i = 0; i < a->fields.size(); i++)
+    {
+        if (a->fields[i] == name)
+        {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+inline mxArray* mxGetField(const mxArray* a, mwIndex i, const char* name)
+{
+    const int field = mxGetFieldNumber(a, name);
+    return field < 0 ? nullptr : a->children.at(i * a->fields.size() + field);
+}
+
+inline void mxSetField(mxArray* a, mwIndex i, const char* name, mxArray* value)
+{
+    const int field = mxGetFieldNumber(a, name);
+    if (field >= 0)
+    {
+        mxArray*& slot = a->children.at(i * a->fields.size() + field);
+        delete slot;
+        slot = value;
+    }
+}
+
+// queries
+
+inline mxClassID mxGetClassID(const mxArray* a) { return a->id; }
+inline size_t mxGetM(const mxArray* a) { return a->m; }
+inline size_t mxGetN(const mxArray* a) { return a->n; }
+inline size_t mxGetNumberOfElements(const mxArray* a) { return a->m * a->n; }
+inline bool mxIsEmpty(const mxArray* a) { return mxGetNumberOfElements(a) == 0; }
+inline bool mxIsChar(const mxArray* a) { return a->id == mxCHAR_CLASS; }
+inline bool mxIsCell(const mxArray* a) { return a->id == mxCELL_CLASS; }
+inline bool mxIsStruct(const mxArray* a) { return a->id == mxSTRUCT_CLASS; }
+inline bool mxIsLogical(const mxArray* a) { return a->id == mxLOGICAL_CLASS; }
+inline bool mxIsDouble(const mxArray* a) { return a->id == mxDOUBLE_CLASS; }
+inline bool mxIsFunctionHandle(const mxArray* a) { return a->id == mxFUNCTION_CLASS; }
+
+// data
+
+inline double* mxGetDoubles(const mxArray* a) { return reinterpret_cast<double*>(const_cast<unsigned char*>(a->data.data())); }
+inline uint8_t* mxGetUint8s(const mxArray* a) { return const_cast<uint8_t*>(a->data.data()); }
+inline uint32_t* mxGetUint32s(const mxArray* a) { return reinterpret_cast<uint32_t*>(const_cast<unsigned char*>(a->data.data())); }
+inline mxLogical* mxGetLogicals(const mxArray* a) { return reinterpret_cast<mxLogical*>(const_cast<unsigned char*>(a->data.data())); }
+inline mxChar* mxGetChars(const mxArray* a) { return reinterpret_cast<mxChar*>(const_cast<unsigned char*>(a->data.data())); }
+
+inline double mxGetScalar(const mxArray* a)
+{
+    if (a->data.empty())
+    {
+        return 0;
+    }
+
+    switch (a->id)
+    {
+        case mxDOUBLE_CLASS:
+            return mxGetDoubles(a)[0];
+        case mxUINT32_CLASS:
+            return mxGetUint32s(a)[0];
+        case mxLOGICAL_CLASS:
+        case mxUINT8_CLASS:
+            return a->data[0];
+        default:
+            return 0;
+    }
+}
+
+inline double mxGetNaN()
+{
+    return std::numeric_limits<double>::quiet_NaN();
+}
+
+inline void mxFree(void* p)
+{
+    std::free(p);
+}
+
+// the characters as UTF-8 (like MATLAB on a UTF-8 system)
+inline char* mxArrayToString(const mxArray* a)
+{
+    const mxChar* chars = mxGetChars(a);
+    const size_t n = mxGetNumberOfElements(a);
+
+    std::string out;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t c = chars[i];
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < n && chars[i+1] >= 0xDC00 && chars[i+1] < 0xE000)
+        {
+            c = 0x10000 + ((c - 0xD800) << 10) + (chars[++i] - 0xDC00);
+        }
+
+        if (c < 0x80)
+        {
+            out += static_cast<char>(c);
+        }
+        else if (c < 0x800)
+        {
+            out += static_cast<char>(0xC0 | (c >> 6));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            out += static_cast<char>(0xE0 | (c >> 12));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            out += static_cast<char>(0xF0 | (c >> 18));
+            out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        }
+    }
+
+    char* str = static_cast<char*>(std::malloc(out.size() + 1));
+    std::memcpy(str, out.c_str(), out.size() + 1);
+    return str;
+}
+
+#endif // FSFIND_SHIM_MATRIX_H
@@ -0,0 +1,102 @@
+// Description: minimal stand-in for MATLAB's mex.h, so that the MEX gateway can
+//              be built & tested without MATLAB.  errors are thrown as
+//              mex_shim::error, and the hooks in mex_shim let a test see
+//              warnings, answer MATLAB callbacks and press Ctrl+C.
+//
+// Author:     Austin Fite
+// Contact:    akfite@gmail.com
+// Date:       2024
+
+#ifndef FSFIND_SHIM_MEX_H
+#define FSFIND_SHIM_MEX_H
+
+#include <cstdarg>
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "matrix.h"
+
+namespace mex_shim
+{
+    // what mexErrMsgIdAndTxt throws (MATLAB would unwind to the prompt)
+    struct error : std::runtime_error
+    {
+        error(const std::string& id, const std::string& message)
+            : std::runtime_error(message), id(id)
+        {
+        }
+
+        std::string id;
+    };
+
+    // identifiers of every warning issued
+    inline std::vector<std::string> warnings;
+
+    // answers mexCallMATLABWithTrap; returns false to make the call fail
+    inline std::function<bool(const char* name, int nrhs, mxArray** prhs)> call_matlab;
+
+    // what utIsInterruptPending returns
+    inline bool interrupt_pending = false;
+
+    inline std::string format(const char* fmt, va_list args)
+    {
+        char buffer[4096];
+        std::vsnprintf(buffer, sizeof(buffer), fmt, args);
+        return buffer;
+    }
+}
+
+extern "C" void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]);
+
+extern "C" inline bool utIsInterruptPending()
+{
+    return mex_shim::interrupt_pending;
+}
+
+inline void mexErrMsgTxt(const char* message)
+{
+    throw mex_shim::error("", message);
+}
+
+inline void mexErrMsgIdAndTxt(const char* id, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    const std::string message = mex_shim::format(fmt, args);
+    va_end(args);
+    throw mex_shim::error(id, message);
+}
+
+inline void mexWarnMsgIdAndTxt(const char* id, const char*, ...)
+{
+    mex_shim::warnings.push_back(id);
+}
+
+inline int mexPrintf(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    const int n = std::vprintf(fmt, args);
+    va_end(args);
+    return n;
+}
+
+inline int mexEvalString(const char*)
+{
+    std::fflush(stdout);
+    return 0;
+}
+
+inline mxArray* mexCallMATLABWithTrap(int, mxArray**, int nrhs, mxArray** prhs, const char* name)
+{
+    if (!mex_shim::call_matlab || mex_shim::call_matlab(name, nrhs, prhs))
+    {
+        return nullptr;
+    }
+    return mxCreateString("MException");
+}
+
+#endif // FSFIND_SHIM_MEX_H
@@ -0,0 +1,765 @@
+// Description: differential test of every way the engine can list a tree.
+//
+//              random trees (with symlinks, unreadable & empty directories,
+//              .gitignore files, unicode, invalid UTF-8 and very long names)
+//              are built on disk, and the (path, type) results of each backend
+//              configuration are compared with a plain serial walk that uses
+//              the same excludes, ignore files and roots.  when they differ,
+//              the tree is shrunk to the smallest one that still shows the
+//              difference.
+//
+//              test_differential [--seed N] [--iterations N] [--self-test]
+//
+//              the seed is random unless given (ctest always gives one, so a
+//              failure there can be repeated).  --self-test adds a backend
+//              that is broken on purpose, and checks that it is caught and
+//              shrunk to a minimal tree.
+//
+// Author:     Austin Fite
+// Contact:    akfite@gmail.com
+// Date:       2024
+
+#include "fsfind_engine.h"
+#include "test_util.h"
+
+#include <map>
+#include <random>
+#include <set>
+#include <tuple>
+
+using fsfind_test::scratch_dir;
+
+namespace
+{
+    enum class node_kind { file, dir, unreadable_dir, file_link, dir_link, dangling_link, looped_link, ignore_file };
+
+    const char* kind_name(node_kind kind)
+    {
+        switch (kind)
+        {
+            case node_kind::file: return "file";
+            case node_kind::dir: return "dir";
+            case node_kind::unreadable_dir: return "unreadable dir";
+            case node_kind::file_link: return "link to file";
+            case node_kind::dir_link: return "link to dir";
+            case node_kind::dangling_link: return "dangling link";
+            case node_kind::looped_link: return "looped link";
+            case node_kind::ignore_file: return "ignore file";
+        }
+        return "?";
+    }
+
+    // one entry of a tree; parents always come before their children
+    struct node
+    {
+        std::string path;       // relative to the root
+        node_kind kind;
+        std::string target;     // what a file link points at (relative to the root), or the
+                                // contents of an ignore file
+    };
+
+    using tree_spec = std::vector<node>;
+
+    // (path relative to the root, type) of every entry found
+    using listing = std::set<std::pair<std::string, int>>;
+
+    // where links to directories point: outside of the tree, so that following
+    // them can never loop
+    const char* OUTSIDE = "outside";
+
+    // a name that is sometimes plain, and sometimes made to be awkward
+    std::string random_name(std::mt19937& rng, size_t index)
+    {
+        static const std::vector<std::string> pieces = {
+            "a", "data", "Report", "x.txt", " spaced out ", "-dash", ".hidden", "caf\xC3\xA9",
+            "\xE6\x97\xA5\xE6\x9C\xAC", "\xF0\x9F\x98\x80", "tab\there", "new\nline", "99", "9",
+        };
+
+        std::string name;
+        switch (rng() % 8)
+        {
+            case 0:
+                // as long as a name can be (255 bytes), in multibyte characters
+                while (name.size() + 3 <= 250)
+                {
+                    name += "\xE2\x82\xAC";
+                }
+                break;
+            case 1:
+                name.assign(200 + rng() % 50, 'L');
+                break;
+#if FSFIND_POSIX
+            case 2:
+                // not valid UTF-8 (Latin-1)
+                name = "latin\xE9\xFF";
+                break;
+#endif
+            default:
+                for (size_t n = 1 + rng() % 3; n > 0; n--)
+                {
+                    name += pieces[rng() % pieces.size()];
+                }
+                break;
+        }
+
+        // unique within the tree, and never "." or ".."
+        return name + "_" + std::to_string(index);
+    }
+
+    tree_spec random_tree(std::mt19937& rng)
+    {
+        tree_spec tree;
+        std::vector<std::string> dirs = {""};
+        std::vector<std::string> files;
+
+        const size_t n = 1 + rng() % 60;
+        for (size_t i = 0; i < n; i++)
+        {
+            const std::string& parent = dirs[rng() % dirs.size()];
+            const std::string path = (parent.empty() ? "" : parent + "/") + random_name(rng, i);
+
+            // keep paths well clear of PATH_MAX
+            if (path.size() > 2000)
+            {
+                continue;
+            }
+
+            const unsigned roll = rng() % 20;
+            node_kind kind = node_kind::file;
+            if (roll < 6)
+            {
+                kind = node_kind::dir;
+            }
+            else if (roll < 7)
+            {
+                kind = node_kind::unreadable_dir;
+            }
+            else if (roll < 9 && !files.empty())
+            {
+                kind = node_kind::file_link;
+            }
+            else if (roll < 11)
+            {
+                kind = node_kind::dir_link;
+            }
+            else if (roll < 12)
+            {
+                kind = node_kind::dangling_link;
+            }
+            else if (roll < 13)
+            {
+                kind = node_kind::looped_link;
+            }
+
+            node entry{path, kind, ""};
+            if (kind == node_kind::file_link)
+            {
+                entry.target = files[rng() % files.size()];
+            }
+            tree.push_back(entry);
+
+            if (kind == node_kind::dir || kind == node_kind::unreadable_dir)
+            {
+                dirs.push_back(path);
+            }
+            else if (kind == node_kind::file)
+            {
+                files.push_back(path);
+            }
+        }
+
+        // a .gitignore in some of the directories, naming entries of the tree
+        // (or a whole class of them, by the last digit of their index)
+        for (const std::string& dir : dirs)
+        {
+            if (rng() % 3 != 0)
+            {
+                continue;
+            }
+
+            std::string rules;
+            for (size_t n = 1 + rng() % 3; n > 0; n--)
+            {
+                std::string rule;
+                if (rng() % 2 == 0 && !tree.empty())
+                {
+                    const std::string& path = tree[rng() % tree.size()].path;
+                    rule = path.substr(path.rfind('/') + 1);
+                }
+                else
+                {
+                    rule = "*" + std::to_string(rng() % 10);
+                }
+
+                // a name with a newline in it can't be written down
+                if (rule.find('\n') != std::string::npos)
+                {
+                    continue;
+                }
+                if (rng() % 4 == 0)
+                {
+                    rule = "!" + rule;
+                }
+                if (rng() % 4 == 0)
+                {
+                    rule += "/";
+                }
+                rules += rule + "\n";
+            }
+            tree.push_back({(dir.empty() ? "" : dir + "/") + ".gitignore", node_kind::ignore_file, rules});
+        }
+        return tree;
+    }
+
+    // builds the tree under base/tree (with base/outside for links to point at);
+    // unreadable directories are only locked once everything is in place
+    void build_tree(const tree_spec& tree, const fs::path& base)
+    {
+        const fs::path root = base / "tree";
+        fs::create_directories(root);
+        fs::create_directories(base / OUTSIDE / "sub");
+        std::ofstream(base / OUTSIDE / "one.txt") << "1";
+        std::ofstream(base / OUTSIDE / "sub" / "two.txt") << "2";
+
+        for (const node& n : tree)
+        {
+            const fs::path p = root / n.path;
+            std::error_code ec;
+            switch (n.kind)
+            {
+                case node_kind::file:
+                    std::ofstream(p) << n.path.size();
+                    break;
+                case node_kind::dir:
+                case node_kind::unreadable_dir:
+                    fs::create_directory(p, ec);
+                    break;
+                case node_kind::file_link:
+                    fs::create_symlink(root / n.target, p, ec);
+                    break;
+                case node_kind::dir_link:
+                    fs::create_directory_symlink(base / OUTSIDE, p, ec);
+                    break;
+                case node_kind::dangling_link:
+                    fs::create_symlink(root / "does not exist", p, ec);
+                    break;
+                case node_kind::looped_link:
+                    fs::create_symlink(p, p, ec);
+                    break;
+                case node_kind::ignore_file:
+                    std::ofstream(p) << n.target;
+                    break;
+            }
+        }
+
+        for (const node& n : tree)
+        {
+            if (n.kind == node_kind::unreadable_dir)
+            {
+                std::error_code ec;
+                fs::permissions(root / n.path, fs::perms::none, ec);
+            }
+        }
+    }
+
+    // so that the scratch directory can be removed
+    void unlock_tree(const tree_spec& tree, const fs::path& base)
+    {
+        for (const node& n : tree)
+        {
+            if (n.kind == node_kind::unreadable_dir)
+            {
+                std::error_code ec;
+                fs::permissions(base / "tree" / n.path, fs::perms::owner_all, ec);
+            }
+        }
+    }
+
+    std::string relative_to(const fs::path& root, std::string_view path)
+    {
+        const std::string prefix = root.string() + "/";
+        return std::string(path.substr(path.compare(0, prefix.size(), prefix) == 0 ? prefix.size() : 0));
+    }
+
+    // what a backend was asked to leave out, and where else it was asked to look
+    struct walk_config
+    {
+        std::vector<std::string> exclude;       // "name" or "*suffix"
+        std::vector<std::string> exclude_dirs;
+        bool respect_ignore_files = false;
+        bool inner_root = false;    // also search the first directory of the tree as a root
+
+        bool operator<(const walk_config& other) const
+        {
+            return std::tie(exclude, exclude_dirs, respect_ignore_files, inner_root)
+                < std::tie(other.exclude, other.exclude_dirs, other.respect_ignore_files, other.inner_root);
+        }
+    };
+
+    // the only kinds of pattern the random trees use
+    bool pattern_matches(const std::string& pattern, const std::string& name)
+    {
+        if (!pattern.empty() && pattern[0] == '*')
+        {
+            const std::string suffix = pattern.substr(1);
+            return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+        }
+        return pattern == name;
+    }
+
+    bool any_matches(const std::vector<std::string>& patterns, const std::string& name)
+    {
+        for (const std::string& pattern : patterns)
+        {
+            if (pattern_matches(pattern, name))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // the lines of the .gitignore in each directory on the way down, innermost last
+    using ignore_stack = std::vector<std::vector<std::string>>;
+
+    std::vector<std::string> read_ignore_file(const fs::path& dir)
+    {
+        std::vector<std::string> lines;
+        std::ifstream file(dir / ".gitignore");
+        for (std::string line; std::getline(file, line); )
+        {
+            lines.push_back(line);
+        }
+        return lines;
+    }
+
+    // like git, the last rule that matches in the innermost file decides
+    bool is_ignored(const ignore_stack& stack, const std::string& name, bool is_dir)
+    {
+        for (auto file = stack.rbegin(); file != stack.rend(); ++file)
+        {
+            for (auto line = file->rbegin(); line != file->rend(); ++line)
+            {
+                std::string pattern = *line;
+                const bool negate = (pattern[0] == '!');
+                if (negate)
+                {
+                    pattern.erase(0, 1);
+                }
+                if (pattern.back() == '/')
+                {
+                    if (!is_dir)
+                    {
+                        continue;
+                    }
+                    pattern.pop_back();
+                }
+                if (pattern_matches(pattern, name))
+                {
+                    return !negate;
+                }
+            }
+        }
+        return false;
+    }
+
+    // the directory searched as a second root, inside the first one: the first
+    // real directory in the tree (or the tree itself again, if there is none)
+    fs::path inner_root(const fs::path& root)
+    {
+        std::set<fs::path> dirs;
+        std::error_code ec;
+        for (fs::directory_iterator it(root, ec); !ec && it != fs::directory_iterator(); it.increment(ec))
+        {
+            std::error_code status_ec;
+            if (fs::symlink_status(it->path(), status_ec).type() == fs::file_type::directory)
+            {
+                dirs.insert(it->path());
+            }
+        }
+        return dirs.empty() ? root : *dirs.begin();
+    }
+
+    // the reference: a serial breadth-first walk of each root, with nothing
+    // clever about it (paths are relative to the first root)
+    listing reference_walk(const fs::path& root, const walk_config& config = walk_config())
+    {
+        std::vector<fs::path> roots = {root};
+        if (config.inner_root)
+        {
+            roots.push_back(inner_root(root));
+        }
+
+        listing out;
+        for (const fs::path& top : roots)
+        {
+            std::deque<std::pair<fs::path, ignore_stack>> pending = {{top, ignore_stack()}};
+            while (!pending.empty())
+            {
+                const fs::path dir = pending.front().first;
+                ignore_stack ignore = pending.front().second;
+                pending.pop_front();
+
+                if (config.respect_ignore_files)
+                {
+                    ignore.push_back(read_ignore_file(dir));
+                }
+
+                std::error_code ec;
+                for (fs::directory_iterator it(dir, ec); !ec && it != fs::directory_iterator(); it.increment(ec))
+                {
+                    const std::string name = it->path().filename().string();
+                    std::error_code status_ec;
+                    const fs::file_type type = fs::status(it->path(), status_ec).type();
+                    const bool is_dir = (type == fs::file_type::directory);
+
+                    if (any_matches(config.exclude, name)
+                        || (is_dir && any_matches(config.exclude_dirs, name))
+                        || (config.respect_ignore_files && is_ignored(ignore, name, is_dir)))
+                    {
+                        continue;
+                    }
+
+                    out.emplace(relative_to(root, it->path().string()), uint8_filetype(type));
+                    if (is_dir)
+                    {
+                        pending.emplace_back(it->path(), ignore);
+                    }
+                }
+            }
+        }
+        return out;
+    }
+
+    // what is left when only directories are sure to have the right type
+    listing without_types(listing all)
+    {
+        listing out;
+        for (const auto& e : all)
+        {
+            out.emplace(e.first, e.second == 3 ? 3 : 0);
+        }
+        return out;
+    }
+
+    // a walk built on the single-folder listing (mex_listfiles with one input)
+    listing get_contents_walk(const fs::path& root)
+    {
+        listing out;
+        std::deque<fs::path> pending = {root};
+        while (!pending.empty())
+        {
+            std::error_code ec;
+            for (const fs::path& p : get_contents(pending.front().string(), ec))
+            {
+                const uint8_t type = uint8_filetype(p);
+                out.emplace(relative_to(root, p.string()), type);
+                if (type == 3)
+                {
+                    pending.push_back(p);
+                }
+            }
+            pending.pop_front();
+        }
+        return out;
+    }
+
+    listing engine_walk(const fs::path& root, search_options opts, bool inner = false)
+    {
+        opts.depth = std::numeric_limits<double>::infinity();
+        std::vector<fs::path> roots = {root};
+        if (inner)
+        {
+            roots.push_back(inner_root(root));
+        }
+        const search_results results = search(roots, opts);
+
+        listing out;
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            out.emplace(relative_to(root, results.path(i)), results.types[i]);
+        }
+        return opts.need_types ? out : without_types(out);
+    }
+
+    struct backend
+    {
+        std::string name;
+        std::function<listing(const fs::path&)> list;
+        walk_config config;     // what the reference must leave out to match
+        bool types = true;      // false if only the types of directories can be compared
+    };
+
+    std::vector<backend> backends(bool self_test)
+    {
+        std::vector<backend> out;
+        out.push_back({"get_contents", get_contents_walk, walk_config()});
+
+        const std::pair<size_t, size_t> concurrency[] = {{1, 1}, {1, 4}, {4, 4}, {1, 64}, {64, 64}};
+        for (const auto& c : concurrency)
+        {
+            for (double threads : {1.0, 0.0})
+            {
+                search_options opts;
+                opts.min_concurrency = c.first;
+                opts.max_concurrency = c.second;
+                opts.threads = threads;
+                opts.sort = (threads == 1) ? sort_key::none : sort_key::natural;
+                opts.collect_stats = true;
+
+                const std::string name = "search (concurrency " + std::to_string(c.first) + "-"
+                    + std::to_string(c.second) + ", " + (threads == 1 ? "1 thread" : "all threads, sorted") + ")";
+                out.push_back({name, [opts](const fs::path& root) { return engine_walk(root, opts); }, walk_config()});
+            }
+        }
+
+        search_options spill;
+        spill.memory_limit = 1;
+        spill.sort = sort_key::path;
+        out.push_back({"search (memory limit)", [spill](const fs::path& root) { return engine_walk(root, spill); },
+            walk_config()});
+
+        // plain files are never stat'd
+        search_options untyped;
+        untyped.need_types = false;
+        out.push_back({"search (no types)", [untyped](const fs::path& root) { return engine_walk(root, untyped); },
+            walk_config(), false});
+
+        // roughly a tenth of the names each, by the last digit of their index
+        walk_config excluded;
+        excluded.exclude = {"*1"};
+        excluded.exclude_dirs = {"*2"};
+        search_options exclude;
+        exclude.exclude = excluded.exclude;
+        exclude.exclude_dirs = excluded.exclude_dirs;
+        out.push_back({"search (excludes)", [exclude](const fs::path& root) { return engine_walk(root, exclude); },
+            excluded});
+
+        walk_config ignoring;
+        ignoring.respect_ignore_files = true;
+        for (double threads : {1.0, 0.0})
+        {
+            search_options ignore;
+            ignore.respect_ignore_files = true;
+            ignore.threads = threads;
+            out.push_back({std::string("search (ignore files, ") + (threads == 1 ? "1 thread)" : "all threads)"),
+                [ignore](const fs::path& root) { return engine_walk(root, ignore); }, ignoring});
+        }
+
+        // the second root is inside the first: searched once when nothing can
+        // stop the first from reaching it, and merged into it otherwise
+        walk_config overlapping;
+        overlapping.inner_root = true;
+        out.push_back({"search (overlapping roots)", [](const fs::path& root)
+        {
+            return engine_walk(root, search_options(), true);
+        }, overlapping});
+
+        overlapping.exclude_dirs = {"*2"};
+        overlapping.respect_ignore_files = true;
+        search_options pruned;
+        pruned.exclude_dirs = overlapping.exclude_dirs;
+        pruned.respect_ignore_files = true;
+        out.push_back({"search (overlapping roots, pruned)", [pruned](const fs::path& root)
+        {
+            return engine_walk(root, pruned, true);
+        }, overlapping});
+
+        if (self_test)
+        {
+            // loses everything three or more levels down
+            out.push_back({"broken on purpose", [](const fs::path& root)
+            {
+                listing all = reference_walk(root);
+                for (auto it = all.begin(); it != all.end(); )
+                {
+                    it = std::count(it->first.begin(), it->first.end(), '/') >= 2 ? all.erase(it) : std::next(it);
+                }
+                return all;
+            }, walk_config()});
+        }
+        return out;
+    }
+
+    // the first backend that disagrees with the reference on this tree (or none)
+    const backend* find_difference(const tree_spec& tree, const std::vector<backend>& all,
+        listing* expected = nullptr, listing* actual = nullptr)
+    {
+        scratch_dir dir;
+        build_tree(tree, dir.path());
+        const fs::path root = dir.path() / "tree";
+
+        const backend* failed = nullptr;
+        std::map<walk_config, listing> references;
+        for (const backend& b : all)
+        {
+            auto walked = references.find(b.config);
+            if (walked == references.end())
+            {
+                walked = references.emplace(b.config, reference_walk(root, b.config)).first;
+            }
+
+            const listing reference = b.types ? walked->second : without_types(walked->second);
+            const listing found = b.list(root);
+            if (found != reference)
+            {
+                failed = &b;
+                if (expected && actual)
+                {
+                    *expected = reference;
+                    *actual = found;
+                }
+                break;
+            }
+        }
+
+        unlock_tree(tree, dir.path());
+        return failed;
+    }
+
+    // removes a node (and everything beneath it)
+    tree_spec without(const tree_spec& tree, size_t i)
+    {
+        const std::string prefix = tree[i].path + "/";
+        tree_spec out;
+        for (size_t j = 0; j < tree.size(); j++)
+        {
+            if (j != i && tree[j].path.compare(0, prefix.size(), prefix) != 0)
+            {
+                out.push_back(tree[j]);
+            }
+        }
+        return out;
+    }
+
+    // greedily removes nodes for as long as the same backend still disagrees
+    tree_spec shrink(tree_spec tree, const backend& failed)
+    {
+        const std::vector<backend> suspect = {failed};
+        bool progress = true;
+        while (progress)
+        {
+            progress = false;
+            for (size_t i = tree.size(); i-- > 0; )
+            {
+                const tree_spec smaller = without(tree, i);
+                if (find_difference(smaller, suspect))
+                {
+                    tree = smaller;
+                    progress = true;
+                    break;
+                }
+            }
+        }
+        return tree;
+    }
+
+    std::string printable(const std::string& s)
+    {
+        std::string out;
+        for (unsigned char c : s)
+        {
+            if (c < 0x20)
+            {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\x%02X", c);
+                out += escaped;
+            }
+            else
+            {
+                out += static_cast<char>(c);
+            }
+        }
+        return out;
+    }
+
+    void report(const tree_spec& tree, const backend& failed)
+    {
+        listing expected;
+        listing actual;
+        find_difference(tree, {failed}, &expected, &actual);
+
+        std::printf("minimal tree (%zu nodes) where \"%s\" differs:\n", tree.size(), failed.name.c_str());
+        for (const node& n : tree)
+        {
+            std::printf("  %-14s %s%s%s\n", kind_name(n.kind), printable(n.path).c_str(),
+                n.target.empty() ? "" : " -> ", printable(n.target).c_str());
+        }
+
+        for (const auto& e : expected)
+        {
+            if (!actual.count(e))
+            {
+                std::printf("  missing:    %s (type %d)\n", printable(e.first).c_str(), e.second);
+            }
+        }
+        for (const auto& e : actual)
+        {
+            if (!expected.count(e))
+            {
+                std::printf("  unexpected: %s (type %d)\n", printable(e.first).c_str(), e.second);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t seed = std::random_device()();
+    int iterations = 50;
+    bool self_test = false;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc)
+        {
+            seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--iterations" && i + 1 < argc)
+        {
+            iterations = std::stoi(argv[++i]);
+        }
+        else if (arg == "--self-test")
+        {
+            self_test = true;
+        }
+        else
+        {
+            std::fprintf(stderr, "usage: test_differential [--seed N] [--iterations N] [--self-test]\n");
+            return 2;
+        }
+    }
+
+    std::printf("seed %u, %d trees\n", seed, iterations);
+    std::mt19937 rng(seed);
+    const std::vector<backend> all = backends(self_test);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        const tree_spec tree = random_tree(rng);
+        if (const backend* failed = find_difference(tree, all))
+        {
+            const tree_spec minimal = shrink(tree, *failed);
+            report(minimal, *failed);
+
+            // the broken backend can always be shown with a/b/c (or with a
+            // single link into the outside directory)
+            if (self_test && failed->name == "broken on purpose")
+            {
+                const bool ok = (minimal.size() <= 3);
+                std::printf("self-test %s\n", ok ? "passed" : "failed (the tree should have shrunk to 3 nodes or less)");
+                return ok ? 0 : 1;
+            }
+            return 1;
+        }
+    }
+
+    if (self_test)
+    {
+        std::printf("self-test failed: the broken backend was never caught\n");
+        return 1;
+    }
+
+    std::printf("every backend agreed\n");
+    return 0;
+}
@@ -0,0 +1,593 @@
+// Description: unit tests of the search engine (no MATLAB involved).
+//
+// Author:     Austin Fite
+// Contact:    akfite@gmail.com
+// Date:       2024
+
+#include "fsfind_engine.h"
+#include "test_util.h"
+
+#if FSFIND_POSIX
+#include <signal.h>
+#include <sys/resource.h>
+#endif
+
+using fsfind_test::scratch_dir;
+
+namespace
+{
+    // the output paths of every result, in order
+    std::vector<std::string> output_paths(const search_results& results)
+    {
+        std::vector<std::string> out;
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            out.emplace_back(results.output_path(i));
+        }
+        return out;
+    }
+
+    std::vector<std::string> filenames(const search_results& results)
+    {
+        std::vector<std::string> out;
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            out.emplace_back(results.filename(i));
+        }
+        return out;
+    }
+
+    search_options deep()
+    {
+        search_options opts;
+        opts.depth = std::numeric_limits<double>::infinity();
+        return opts;
+    }
+
+    // a/1.txt, a/b/2.txt, a/b/c/3.m, d/4.m, 5.txt
+    void make_tree(const scratch_dir& dir)
+    {
+        dir.file("a/1.txt", "one\n");
+        dir.file("a/b/2.txt", "two\ntwo\n");
+        dir.file("a/b/c/3.m", "x = 3;\n");
+        dir.file("d/4.m", "% four\n");
+        dir.file("5.txt", "five\nfive\nfive\n");
+    }
+}
+
+TEST(depth_limits_the_search)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    search_options opts;
+    CHECK_EQ(search({dir.path()}, opts).size(), 3u);
+
+    opts.depth = 2;
+    CHECK_EQ(search({dir.path()}, opts).size(), 6u);
+
+    CHECK_EQ(search({dir.path()}, deep()).size(), 9u);
+}
+
+TEST(results_are_breadth_first)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    const search_results results = search({dir.path()}, deep());
+    size_t last_depth = 0;
+    for (const std::string& p : output_paths(results))
+    {
+        const fs::path relative = fs::path(p).lexically_relative(dir.path());
+        const size_t depth = std::distance(relative.begin(), relative.end());
+        CHECK(depth >= last_depth);
+        last_depth = depth;
+    }
+}
+
+TEST(pattern_matches_names)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    search_options opts = deep();
+    opts.pattern = "\\.m$";
+    opts.sort = sort_key::name;
+    CHECK(filenames(search({dir.path()}, opts)) == std::vector<std::string>({"3.m", "4.m"}));
+
+    opts.pattern = "\\.M$";
+    CHECK_EQ(search({dir.path()}, opts).size(), 0u);
+
+    opts.case_sensitive = false;
+    CHECK_EQ(search({dir.path()}, opts).size(), 2u);
+}
+
+TEST(bad_pattern_throws)
+{
+    scratch_dir dir;
+    search_options opts;
+    opts.pattern = "(";
+    CHECK_THROWS(search({dir.path()}, opts), std::regex_error);
+}
+
+TEST(exclude_skips_names_and_directories)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    search_options opts = deep();
+    opts.exclude = {"*.txt"};
+    CHECK_EQ(search({dir.path()}, opts).size(), 6u);
+
+    opts = deep();
+    opts.exclude_dirs = {"b"};
+    const std::vector<std::string> names = filenames(search({dir.path()}, opts));
+    CHECK_EQ(names.size(), 5u);
+    CHECK(std::find(names.begin(), names.end(), "2.txt") == names.end());
+
+    opts = deep();
+    opts.exclude_dirs = {"^[bd]$"};
+    opts.exclude_regex = true;
+    CHECK_EQ(search({dir.path()}, opts).size(), 3u);
+}
+
+TEST(depthwise_pattern_guides_the_search)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    search_options opts;
+    opts.depthwise_pattern = {"a", "b"};
+    opts.depth = 3;
+    CHECK(filenames(search({dir.path()}, opts)) == std::vector<std::string>({"2.txt", "c"}));
+}
+
+TEST(sort_orders_results)
+{
+    scratch_dir dir;
+    dir.file("f10", "0123456789");
+    dir.file("f9", "012");
+    dir.file("f1", "01234");
+
+    search_options opts;
+    opts.sort = sort_key::name;
+    CHECK(filenames(search({dir.path()}, opts)) == std::vector<std::string>({"f1", "f10", "f9"}));
+
+    opts.sort = sort_key::natural;
+    CHECK(filenames(search({dir.path()}, opts)) == std::vector<std::string>({"f1", "f9", "f10"}));
+
+    opts.sort = sort_key::size;
+    opts.collect_stats = true;
+    CHECK(filenames(search({dir.path()}, opts)) == std::vector<std::string>({"f9", "f1", "f10"}));
+}
+
+TEST(memory_limit_does_not_change_results)
+{
+    // a few MiB of paths (the arena never goes below two 1 MiB chunks)
+    scratch_dir dir;
+    const std::string padding(200, 'x');
+    for (int i = 0; i < 20; i++)
+    {
+        for (int j = 0; j < 1000; j++)
+        {
+            dir.file("dir_" + std::to_string(i) + "/" + std::to_string(j) + padding);
+        }
+    }
+
+    for (sort_key key : {sort_key::none, sort_key::name, sort_key::natural})
+    {
+        search_options opts = deep();
+        opts.sort = key;
+        const search_results expected = search({dir.path()}, opts);
+
+        opts.memory_limit = 1;
+        const search_results spilled = search({dir.path()}, opts);
+
+        CHECK(spilled.stats.spilled > 0);
+        CHECK(!spilled.stats.spill_failed);
+        CHECK(output_paths(spilled) == output_paths(expected));
+        CHECK(filenames(spilled) == filenames(expected));
+        CHECK(spilled.types == expected.types);
+    }
+}
+
+#if FSFIND_POSIX
+TEST(sort_falls_back_when_the_runs_cannot_be_written)
+{
+    scratch_dir dir;
+    const std::string padding(200, 'x');
+    for (int i = 0; i < 20; i++)
+    {
+        for (int j = 0; j < 1000; j++)
+        {
+            dir.file("dir_" + std::to_string(i) + "/" + std::to_string(j) + padding);
+        }
+    }
+
+    search_options opts = deep();
+    opts.memory_limit = 1;
+    const uint64_t arena_bytes = search({dir.path()}, opts).stats.spilled;
+
+    opts.sort = sort_key::path;
+    opts.memory_limit = std::numeric_limits<double>::infinity();
+    const search_results expected = search({dir.path()}, opts);
+
+    // room for the arena's own file, but not for the sorted runs (which hold
+    // every path, plus a header each)
+    struct rlimit saved;
+    getrlimit(RLIMIT_FSIZE, &saved);
+    struct rlimit capped = saved;
+    capped.rlim_cur = static_cast<rlim_t>(arena_bytes + (1 << 20));
+    void (*handler)(int) = signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &capped);
+
+    opts.memory_limit = 1;
+    const search_results fallback = search({dir.path()}, opts);
+
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, handler);
+
+    CHECK(fallback.stats.spill_failed);
+    CHECK(output_paths(fallback) == output_paths(expected));
+}
+#endif
+
+TEST(arena_holds_paths_longer_than_a_chunk)
+{
+    path_arena arena;
+    const std::string huge((1 << 20) + 10, 'h');
+    const path_arena::ref a = arena.store("before");
+    const path_arena::ref b = arena.store(huge);
+    const path_arena::ref c = arena.store("after");
+    const path_arena::ref d = arena.store(huge);
+
+    CHECK_EQ(std::string(arena.get(a)), "before");
+    CHECK(std::string(arena.get(b)) == huge);
+    CHECK_EQ(std::string(arena.get(c)), "after");
+    CHECK(std::string(arena.get(d)) == huge);
+}
+
+TEST(untyped_search_still_recurses)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    search_options opts = deep();
+    opts.sort = sort_key::path;
+    const search_results expected = search({dir.path()}, opts);
+
+    opts.need_types = false;
+    const search_results untyped = search({dir.path()}, opts);
+    CHECK(output_paths(untyped) == output_paths(expected));
+}
+
+TEST(unique_inodes_keeps_the_first_link)
+{
+    scratch_dir dir;
+    dir.file("b/file", "linked");
+    dir.file("c/other", "not linked");
+    fs::create_directory(dir.path() / "a");
+    fs::create_hard_link(dir.path() / "b" / "file", dir.path() / "a" / "link");
+    fs::create_hard_link(dir.path() / "b" / "file", dir.path() / "c" / "link");
+
+    search_options opts = deep();
+    opts.sort = sort_key::path;
+    opts.collect_links = true;
+    search_results results = search({dir.path()}, opts);
+    CHECK_EQ(results.size(), 7u);
+
+    opts.unique_inodes = true;
+    results = search({dir.path()}, opts);
+    CHECK(filenames(results) == std::vector<std::string>({"a", "link", "b", "c", "other"}));
+    CHECK_EQ(results.links.size(), 5u);
+    if (results.links.size() == 5)
+    {
+        CHECK(results.links[1] == 3 && results.links[4] == 1);
+    }
+
+    // the first path in the requested order is the one kept
+    opts.sort = sort_key::name;
+    results = search({dir.path()}, opts);
+    CHECK(filenames(results) == std::vector<std::string>({"a", "b", "c", "file", "other"}));
+}
+
+TEST(relative_paths_drop_the_root)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    search_options opts;
+    opts.relative_paths = true;
+    opts.sort = sort_key::path;
+    CHECK(output_paths(search({dir.path()}, opts)) == std::vector<std::string>({"5.txt", "a", "d"}));
+}
+
+TEST(overlapping_roots_are_searched_once)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    const search_results results = search({dir.path(), dir.path() / "a"}, deep());
+    CHECK_EQ(results.size(), 9u);
+}
+
+TEST(overlapping_roots_keep_every_path_through_links)
+{
+    scratch_dir dir;
+    make_tree(dir);
+    fs::create_directory_symlink(dir.path() / "d", dir.path() / "a" / "one");
+    fs::create_directory_symlink(dir.path() / "d", dir.path() / "a" / "two");
+
+    // the exclude keeps both roots, so their results are merged
+    search_options opts = deep();
+    opts.exclude = {"nothing"};
+    const search_results results = search({dir.path(), dir.path() / "a"}, opts);
+
+    std::vector<std::string> names = filenames(results);
+    CHECK_EQ(std::count(names.begin(), names.end(), "4.m"), 3);
+    CHECK_EQ(results.size(), 13u);
+}
+
+TEST(contents_are_searched)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    search_options opts = deep();
+    opts.contains_text = "five";
+    search_results results = search({dir.path()}, opts);
+    CHECK(filenames(results) == std::vector<std::string>({"5.txt"}));
+    CHECK(results.lines == std::vector<uint64_t>({1}));
+
+    opts.contains_text.clear();
+    opts.contains_regex = "^x = \\d";
+    results = search({dir.path()}, opts);
+    CHECK(filenames(results) == std::vector<std::string>({"3.m"}));
+}
+
+TEST(hashes_are_known_digests)
+{
+    scratch_dir dir;
+    dir.file("abc", "abc");
+
+    search_options opts;
+    opts.hash = hash_kind::sha256;
+    search_results results = search({dir.path()}, opts);
+    CHECK_EQ(results.hashes.at(0), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+    opts.hash = hash_kind::xxh3;
+    results = search({dir.path()}, opts);
+    CHECK_EQ(results.hashes.at(0), "78af5f94892f3950");
+}
+
+TEST(duplicates_are_grouped)
+{
+    scratch_dir dir;
+    dir.file("x/one", "same contents");
+    dir.file("y/two", "same contents");
+    dir.file("y/three", "same length!!");
+    dir.file("empty1");
+    dir.file("empty2");
+
+    search_options opts = deep();
+    opts.mode = search_mode::duplicates;
+    opts.collect_stats = true;
+    opts.min_size = 1;
+    const search_results results = search({dir.path()}, opts);
+    const duplicate_groups groups = find_duplicates(results, opts);
+
+    CHECK_EQ(groups.duplicates.size(), 1u);
+    if (groups.duplicates.size() == 1)
+    {
+        std::vector<std::string> names;
+        for (size_t i : groups.duplicates[0])
+        {
+            names.emplace_back(results.filename(i));
+        }
+        std::sort(names.begin(), names.end());
+        CHECK(names == std::vector<std::string>({"one", "two"}));
+    }
+}
+
+TEST(disk_usage_totals_each_directory)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    search_options opts = deep();
+    opts.mode = search_mode::disk_usage;
+    opts.report_depth = 1;
+    const search_results results = search({dir.path()}, opts);
+
+    CHECK_EQ(results.usage.size(), 3u);
+    if (results.usage.size() == 3)
+    {
+        CHECK_EQ(results.usage[0].files, 5u);
+        CHECK_EQ(results.usage[0].dirs, 4u);
+        // directories have a size of their own
+        CHECK(results.usage[0].apparent >= 4u + 8u + 7u + 7u + 15u);
+        CHECK(results.usage[0].allocated > 0);
+    }
+}
+
+TEST(disk_usage_counts_hard_links_in_the_first_directory)
+{
+    scratch_dir dir;
+    dir.file("a/linked", std::string(5000, 'x'));
+    dir.dir("b");
+    dir.dir("c");
+    for (int i = 0; i < 20; i++)
+    {
+        fs::create_hard_link(dir.path() / "a" / "linked", dir.path() / "c" / ("link" + std::to_string(i)));
+    }
+    fs::create_hard_link(dir.path() / "a" / "linked", dir.path() / "b" / "link");
+
+    // the bytes go to whichever directory comes first in the (serial) listing
+    // order, no matter how many directories are read at once
+    std::string owner;
+    for (size_t readers : {1, 4, 16})
+    {
+        search_options opts = deep();
+        opts.mode = search_mode::disk_usage;
+        opts.report_depth = 1;
+        opts.min_concurrency = opts.max_concurrency = readers;
+        const search_results results = search({dir.path()}, opts);
+
+        CHECK_EQ(results.usage.size(), 4u);
+        size_t owners = 0;
+        for (size_t i = 1; i < results.usage.size(); i++)
+        {
+            const usage_node& node = results.usage[i];
+            if (node.apparent == 5000)
+            {
+                owners++;
+                CHECK(owner.empty() || owner == node.path);
+                owner = node.path;
+            }
+            else
+            {
+                CHECK_EQ(node.apparent, 0u);
+            }
+        }
+        CHECK_EQ(owners, 1u);
+        CHECK_EQ(results.usage[0].files, 22u);
+    }
+}
+
+TEST(missing_root_is_an_error)
+{
+    scratch_dir dir;
+    const search_results results = search({dir.path() / "missing"}, search_options());
+
+    CHECK_EQ(results.size(), 0u);
+    CHECK_EQ(results.errors.size(), 1u);
+    if (!results.errors.empty())
+    {
+        CHECK_EQ(std::string(results.errors[0].operation), "opendir");
+        CHECK(results.errors[0].ec == std::errc::no_such_file_or_directory);
+    }
+}
+
+TEST(interrupt_abandons_the_search)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    search_options opts = deep();
+    opts.interrupted = []() { return true; };
+    CHECK(search({dir.path()}, opts).stats.interrupted);
+}
+
+TEST(interrupt_after_the_crawl_stops_the_slow_stages)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    // let the crawl start, then interrupt (a slow machine may catch the crawl
+    // itself, which leaves no content matches either)
+    size_t calls = 0;
+    search_options opts = deep();
+    opts.contains_text = "five";
+    opts.hash = hash_kind::sha256;
+    opts.interrupted = [&]() { return calls++ > 0; };
+
+    const search_results results = search({dir.path()}, opts);
+    CHECK(results.stats.interrupted);
+    CHECK(results.lines.empty() || results.size() == 0);
+
+    opts = deep();
+    opts.mode = search_mode::duplicates;
+    opts.collect_stats = true;
+    dir.file("x/one", "same contents");
+    dir.file("y/two", "same contents");
+    const search_results all = search({dir.path()}, opts);
+
+    opts.interrupted = []() { return true; };
+    const duplicate_groups groups = find_duplicates(all, opts);
+    CHECK(groups.interrupted);
+    CHECK(groups.duplicates.empty());
+}
+
+TEST(progress_is_reported)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    std::vector<search_progress> reports;
+    search_options opts = deep();
+    opts.progress = [&](const search_progress& progress)
+    {
+        reports.push_back(progress);
+        return true;
+    };
+    search({dir.path()}, opts);
+
+    // there is always a final tally
+    CHECK(!reports.empty());
+    if (!reports.empty())
+    {
+        CHECK_EQ(reports.back().directories, 5u);
+        CHECK_EQ(reports.back().entries, 9u);
+        CHECK_EQ(reports.back().matches, 9u);
+    }
+}
+
+TEST(directory_table_lists_each_parent_once)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    const search_results results = search({dir.path()}, deep());
+    const directory_table table = build_directory_table(results);
+
+    CHECK_EQ(table.dirs.size(), 5u);
+    CHECK_EQ(table.parent.size(), results.size());
+    for (size_t i = 0; i < results.size() && i < table.parent.size(); i++)
+    {
+        const fs::path p(std::string(results.path(i)));
+        CHECK_EQ(fs::path(table.dirs.at(table.parent[i])), p.parent_path());
+    }
+}
+
+TEST(get_contents_lists_a_folder)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    std::error_code ec;
+    const std::list<fs::path> contents = get_contents(dir.path().string(), ec);
+    CHECK(!ec);
+    CHECK_EQ(contents.size(), 3u);
+    CHECK_EQ(uint8_filetype(dir.path() / "5.txt"), 2);
+    CHECK_EQ(uint8_filetype(dir.path() / "a"), 3);
+    CHECK_EQ(uint8_filetype(dir.path() / "missing"), 1);
+
+    get_contents((dir.path() / "missing").string(), ec);
+    CHECK(static_cast<bool>(ec));
+}
+
+TEST(list_folders_keeps_the_folder_order)
+{
+    scratch_dir dir;
+    make_tree(dir);
+
+    const std::vector<std::string> folders = {
+        (dir.path() / "d").string(), (dir.path() / "missing").string(), (dir.path() / "a").string()};
+    for (double threads : {1.0, 4.0})
+    {
+        const folder_listing listing = list_folders(folders, true, threads);
+        CHECK_EQ(listing.paths.size(), 3u);
+        CHECK(listing.folder == std::vector<uint32_t>({0, 2, 2}));
+        CHECK_EQ(listing.types.size(), 3u);
+        CHECK_EQ(listing.paths.at(0).filename().string(), "4.m");
+        CHECK_EQ(listing.errors.size(), 1u);
+        CHECK_EQ(listing.errors.at(0).path, folders[1]);
+    }
+
+    CHECK(list_folders(folders, false).types.empty());
+}
+
+int main(int argc, char** argv)
+{
+    return fsfind_test::run_all(argc, argv);
+}
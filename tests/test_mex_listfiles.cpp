@@ -0,0 +1,368 @@
+// Description: unit tests of the MEX gateway, built against the mex.h/matrix.h
+//              stand-ins in tests/shim.
+//
+// Author:     Austin Fite
+// Contact:    akfite@gmail.com
+// Date:       2024
+
+#include "mex.h"
+#include "test_util.h"
+
+#include <cmath>
+#include <memory>
+
+using fsfind_test::scratch_dir;
+
+namespace
+{
+    struct array_deleter
+    {
+        void operator()(mxArray* a) const { mxDestroyArray(a); }
+    };
+
+    using array_ptr = std::unique_ptr<mxArray, array_deleter>;
+
+    // the options struct passed to mex_listfiles
+    class options
+    {
+    public:
+        options& set(const char* name, mxArray* value)
+        {
+            names_.push_back(name);
+            values_.emplace_back(value);
+            return *this;
+        }
+
+        options& set(const char* name, const char* value) { return set(name, mxCreateString(value)); }
+        options& set(const char* name, double value) { return set(name, mxCreateDoubleScalar(value)); }
+
+        array_ptr build()
+        {
+            std::vector<const char*> fields;
+            for (const std::string& name : names_)
+            {
+                fields.push_back(name.c_str());
+            }
+
+            array_ptr out(mxCreateStructMatrix(1, 1, static_cast<int>(fields.size()), fields.data()));
+            for (size_t i = 0; i < fields.size(); i++)
+            {
+                mxSetField(out.get(), 0, fields[i], values_[i].release());
+            }
+            return out;
+        }
+
+    private:
+        std::vector<std::string> names_;
+        std::vector<array_ptr> values_;
+    };
+
+    // calls mex_listfiles, and takes ownership of its outputs
+    std::vector<array_ptr> call(int nargout, std::vector<const mxArray*> inputs)
+    {
+        std::vector<mxArray*> outputs(std::max(nargout, 1), nullptr);
+        mexFunction(nargout, outputs.data(), static_cast<int>(inputs.size()), inputs.data());
+
+        std::vector<array_ptr> out;
+        for (mxArray* a : outputs)
+        {
+            out.emplace_back(a);
+        }
+        return out;
+    }
+
+    std::string to_string(const mxArray* a)
+    {
+        char* str = mxArrayToString(a);
+        std::string out(str);
+        mxFree(str);
+        return out;
+    }
+
+    std::vector<std::string> cell_strings(const mxArray* cell)
+    {
+        std::vector<std::string> out;
+        for (size_t i = 0; i < mxGetNumberOfElements(cell); i++)
+        {
+            out.push_back(to_string(mxGetCell(cell, i)));
+        }
+        return out;
+    }
+}
+
+TEST(lists_a_single_folder)
+{
+    scratch_dir dir;
+    dir.file("file.txt");
+    dir.dir("folder");
+
+    array_ptr folder(mxCreateString(dir.path().string().c_str()));
+    const std::vector<array_ptr> out = call(3, {folder.get()});
+
+    std::vector<std::string> names = cell_strings(out[1].get());
+    std::sort(names.begin(), names.end());
+    CHECK(names == std::vector<std::string>({"file.txt", "folder"}));
+    CHECK_EQ(mxGetNumberOfElements(out[2].get()), 2u);
+}
+
+TEST(missing_folder_is_an_error)
+{
+    scratch_dir dir;
+    array_ptr folder(mxCreateString((dir.path() / "missing").string().c_str()));
+
+    try
+    {
+        call(3, {folder.get()});
+        CHECK(false);
+    }
+    catch (const mex_shim::error& err)
+    {
+        CHECK_EQ(err.id, "fsfind:listing_failed");
+    }
+}
+
+TEST(lists_many_folders_at_once)
+{
+    scratch_dir dir;
+    dir.file("a/1");
+    dir.file("a/2");
+    dir.dir("b");
+    dir.file("c/3");
+
+    array_ptr folders(mxCreateCellMatrix(4, 1));
+    const char* names[] = {"a", "b", "missing", "c"};
+    for (mwIndex i = 0; i < 4; i++)
+    {
+        mxSetCell(folders.get(), i, mxCreateString((dir.path() / names[i]).string().c_str()));
+    }
+
+    mex_shim::warnings.clear();
+    const std::vector<array_ptr> out = call(4, {folders.get()});
+    CHECK(mex_shim::warnings == std::vector<std::string>({"fsfind:listing_failed"}));
+
+    std::vector<std::string> listed = cell_strings(out[1].get());
+    std::sort(listed.begin(), listed.begin() + 2);
+    CHECK(listed == std::vector<std::string>({"1", "2", "3"}));
+    CHECK_EQ(mxGetUint8s(out[2].get())[2], 2);
+
+    const double* folder = mxGetDoubles(out[3].get());
+    CHECK_EQ(mxGetNumberOfElements(out[3].get()), 3u);
+    CHECK(folder[0] == 1 && folder[1] == 1 && folder[2] == 4);
+}
+
+TEST(searches_with_options)
+{
+    scratch_dir dir;
+    dir.file("a/b/deep.m", "x = 1;\n");
+    dir.file("top.m");
+    dir.file("top.txt");
+
+    array_ptr folder(mxCreateString(dir.path().string().c_str()));
+    array_ptr opts = options()
+        .set("Pattern", "\\.m$")
+        .set("Depth", INFINITY)
+        .set("Sort", "name")
+        .build();
+    const std::vector<array_ptr> out = call(6, {folder.get(), opts.get()});
+
+    CHECK(cell_strings(out[1].get()) == std::vector<std::string>({"deep.m", "top.m"}));
+    CHECK_EQ(cell_strings(out[0].get()).at(1), (dir.path() / "top.m").string());
+    CHECK_EQ(mxGetUint8s(out[2].get())[0], 2);
+    CHECK(std::isnan(mxGetDoubles(out[3].get())[0]));
+    CHECK_EQ(mxGetScalar(mxGetField(out[5].get(), 0, "Directories")), 3.0);
+}
+
+TEST(single_output_is_only_the_paths)
+{
+    scratch_dir dir;
+    dir.file("a/b/deep.m");
+    dir.file("top.m");
+
+    array_ptr folder(mxCreateString(dir.path().string().c_str()));
+    array_ptr opts = options().set("Depth", INFINITY).set("Sort", "path").build();
+    const std::vector<array_ptr> out = call(1, {folder.get(), opts.get()});
+
+    CHECK_EQ(out.size(), 1u);
+    CHECK(cell_strings(out[0].get()) == std::vector<std::string>({
+        (dir.path() / "a").string(),
+        (dir.path() / "a" / "b").string(),
+        (dir.path() / "a" / "b" / "deep.m").string(),
+        (dir.path() / "top.m").string()}));
+
+    const std::vector<array_ptr> listing = call(1, {folder.get()});
+    CHECK_EQ(mxGetNumberOfElements(listing[0].get()), 2u);
+}
+
+TEST(links_are_counted)
+{
+    scratch_dir dir;
+    dir.file("file");
+    std::filesystem::create_hard_link(dir.path() / "file", dir.path() / "link");
+
+    array_ptr folder(mxCreateString(dir.path().string().c_str()));
+    array_ptr opts = options().set("Sort", "name").build();
+    std::vector<array_ptr> out = call(8, {folder.get(), opts.get()});
+    CHECK_EQ(mxGetNumberOfElements(out[7].get()), 2u);
+    CHECK_EQ(mxGetDoubles(out[7].get())[1], 2.0);
+
+    opts = options().set("UniqueInodes", mxCreateLogicalScalar(true)).build();
+    out = call(1, {folder.get(), opts.get()});
+    CHECK_EQ(mxGetNumberOfElements(out[0].get()), 1u);
+}
+
+TEST(names_are_utf16)
+{
+    scratch_dir dir;
+    const std::string name = "caf\xC3\xA9 \xF0\x9F\x98\x80";    // "café 😀"
+    dir.file(name);
+
+    array_ptr folder(mxCreateString(dir.path().string().c_str()));
+    array_ptr opts = options().build();
+    const std::vector<array_ptr> out = call(2, {folder.get(), opts.get()});
+
+    const mxArray* str = mxGetCell(out[1].get(), 0);
+    CHECK_EQ(mxGetNumberOfElements(str), 7u);  // the emoji is a surrogate pair
+    CHECK_EQ(static_cast<int>(mxGetChars(str)[3]), 0xE9);
+    CHECK_EQ(to_string(str), name);
+}
+
+TEST(invalid_utf8_is_replaced)
+{
+    scratch_dir dir;
+    const std::string name = "bad\xFFname";
+    if (!std::ofstream(dir.path() / name))
+    {
+        return; // the filesystem won't take it
+    }
+
+    array_ptr folder(mxCreateString(dir.path().string().c_str()));
+    array_ptr opts = options().build();
+    const std::vector<array_ptr> out = call(2, {folder.get(), opts.get()});
+
+    const mxArray* str = mxGetCell(out[1].get(), 0);
+    CHECK_EQ(mxGetNumberOfElements(str), 8u);
+    CHECK_EQ(static_cast<int>(mxGetChars(str)[3]), 0xFFFD);
+}
+
+TEST(raw_names_keep_the_bytes)
+{
+    scratch_dir dir;
+    dir.file("a/one");
+    dir.file("two");
+
+    array_ptr folder(mxCreateString(dir.path().string().c_str()));
+    array_ptr opts = options()
+        .set("Depth", INFINITY)
+        .set("RawNames", 1.0)
+        .set("Sort", "path")
+        .build();
+    const std::vector<array_ptr> out = call(3, {folder.get(), opts.get()});
+
+    const mxArray* bytes = mxGetField(out[0].get(), 0, "Bytes");
+    const double* offsets = mxGetDoubles(mxGetField(out[0].get(), 0, "Offsets"));
+    const double* names = mxGetDoubles(mxGetField(out[0].get(), 0, "NameOffsets"));
+    const char* data = reinterpret_cast<const char*>(mxGetUint8s(bytes));
+
+    CHECK_EQ(mxGetNumberOfElements(mxGetField(out[0].get(), 0, "NameOffsets")), 3u);
+    CHECK_EQ(std::string(data + static_cast<size_t>(offsets[2]), static_cast<size_t>(offsets[3] - offsets[2])),
+        (dir.path() / "two").string());
+    CHECK_EQ(std::string(data + static_cast<size_t>(names[1]), static_cast<size_t>(offsets[2] - names[1])), "one");
+}
+
+TEST(bad_options_are_errors)
+{
+    scratch_dir dir;
+    array_ptr folder(mxCreateString(dir.path().string().c_str()));
+
+    const std::vector<std::pair<array_ptr, std::string>> cases = [&]()
+    {
+        std::vector<std::pair<array_ptr, std::string>> out;
+        out.emplace_back(options().set("Sort", "sideways").build(), "fsfind:bad_option");
+        out.emplace_back(options().set("Pattern", "(").build(), "fsfind:bad_pattern");
+        out.emplace_back(options().set("RawNames", 1.0).set("Output", "tree").build(), "fsfind:bad_option");
+        out.emplace_back(options().set("Concurrency", INFINITY).build(), "fsfind:bad_option");
+        out.emplace_back(options().set("Concurrency", NAN).build(), "fsfind:bad_option");
+        out.emplace_back(options().set("Concurrency", 0.0).build(), "fsfind:bad_option");
+        return out;
+    }();
+
+    for (const auto& c : cases)
+    {
+        try
+        {
+            call(3, {folder.get(), c.first.get()});
+            CHECK(false);
+        }
+        catch (const mex_shim::error& err)
+        {
+            CHECK_EQ(err.id, c.second);
+        }
+    }
+}
+
+TEST(ctrl_c_is_an_error)
+{
+    scratch_dir dir;
+    dir.file("x");
+
+    array_ptr folder(mxCreateString(dir.path().string().c_str()));
+    array_ptr opts = options().build();
+
+    mex_shim::interrupt_pending = true;
+    try
+    {
+        call(3, {folder.get(), opts.get()});
+        CHECK(false);
+    }
+    catch (const mex_shim::error& err)
+    {
+        CHECK_EQ(err.id, "fsfind:interrupted");
+    }
+    mex_shim::interrupt_pending = false;
+}
+
+TEST(progress_callback_failure_is_a_warning)
+{
+    scratch_dir dir;
+    dir.file("x");
+
+    array_ptr folder(mxCreateString(dir.path().string().c_str()));
+    array_ptr handle(mxCreateNumericMatrix(1, 1, mxFUNCTION_CLASS, mxREAL));
+    array_ptr opts = options().set("Progress", handle.release()).build();
+
+    int calls = 0;
+    mex_shim::warnings.clear();
+    mex_shim::call_matlab = [&](const char* name, int nrhs, mxArray** prhs)
+    {
+        calls++;
+        CHECK_EQ(std::string(name), "feval");
+        CHECK_EQ(nrhs, 2);
+        CHECK(mxGetField(prhs[1], 0, "Entries") != nullptr);
+        return false;
+    };
+    const std::vector<array_ptr> out = call(3, {folder.get(), opts.get()});
+    mex_shim::call_matlab = nullptr;
+
+    CHECK_EQ(calls, 1);
+    CHECK(mex_shim::warnings == std::vector<std::string>({"fsfind:progress_failed"}));
+    CHECK_EQ(mxGetNumberOfElements(out[0].get()), 1u);
+}
+
+TEST(errors_are_returned_as_a_struct)
+{
+    scratch_dir dir;
+    array_ptr roots(mxCreateCellMatrix(1, 1));
+    mxSetCell(roots.get(), 0, mxCreateString((dir.path() / "missing").string().c_str()));
+    array_ptr opts = options().build();
+
+    const std::vector<array_ptr> out = call(7, {roots.get(), opts.get()});
+    const mxArray* errors = out[6].get();
+    CHECK_EQ(mxGetNumberOfElements(mxGetField(errors, 0, "Path")), 1u);
+    CHECK_EQ(cell_strings(mxGetField(errors, 0, "Operation")).at(0), "opendir");
+    CHECK_EQ(mxGetScalar(mxGetField(errors, 0, "Errno")), static_cast<double>(ENOENT));
+}
+
+int main(int argc, char** argv)
+{
+    return fsfind_test::run_all(argc, argv);
+}
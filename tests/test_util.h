@@ -0,0 +1,159 @@
+// Description: just enough of a unit test framework for the fsfind tests (no
+//              dependencies), plus a scratch directory for building trees.
+//
+// Author:     Austin Fite
+// Contact:    akfite@gmail.com
+// Date:       2024
+
+#ifndef FSFIND_TEST_UTIL_H
+#define FSFIND_TEST_UTIL_H
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fsfind_test
+{
+    struct test_case
+    {
+        const char* name;
+        std::function<void()> run;
+    };
+
+    inline std::vector<test_case>& registry()
+    {
+        static std::vector<test_case> tests;
+        return tests;
+    }
+
+    inline int failures = 0;
+
+    struct registrar
+    {
+        registrar(const char* name, std::function<void()> run)
+        {
+            registry().push_back({name, std::move(run)});
+        }
+    };
+
+    inline void fail(const char* file, int line, const std::string& what)
+    {
+        std::fprintf(stderr, "  %s:%d: %s\n", file, line, what.c_str());
+        failures++;
+    }
+
+    template <typename A, typename B>
+    inline void check_equal(const A& a, const B& b, const char* expr_a, const char* expr_b, const char* file, int line)
+    {
+        if (!(a == b))
+        {
+            std::ostringstream msg;
+            msg << expr_a << " == " << expr_b << " (" << a << " vs " << b << ")";
+            fail(file, line, msg.str());
+        }
+    }
+
+    // runs every test (or those whose names contain argv[1]); returns the exit code
+    inline int run_all(int argc, char** argv)
+    {
+        const std::string filter = argc > 1 ? argv[1] : "";
+        int failed_tests = 0;
+        for (const test_case& test : registry())
+        {
+            if (std::string(test.name).find(filter) == std::string::npos)
+            {
+                continue;
+            }
+
+            const int before = failures;
+            try
+            {
+                test.run();
+            }
+            catch (const std::exception& err)
+            {
+                fail(__FILE__, __LINE__, std::string("unexpected exception: ") + err.what());
+            }
+
+            const bool ok = (failures == before);
+            failed_tests += ok ? 0 : 1;
+            std::printf("[%s] %s\n", ok ? "  OK  " : " FAIL ", test.name);
+        }
+        return failed_tests == 0 ? 0 : 1;
+    }
+
+    // a directory that is removed (with everything in it) when this goes out of scope
+    class scratch_dir
+    {
+    public:
+        scratch_dir()
+        {
+            std::random_device seed;
+            path_ = std::filesystem::temp_directory_path() / ("fsfind_test_" + std::to_string(seed()));
+            std::filesystem::create_directories(path_);
+        }
+
+        ~scratch_dir()
+        {
+            std::error_code ec;
+            std::filesystem::permissions(path_, std::filesystem::perms::owner_all,
+                std::filesystem::perm_options::add, ec);
+            std::filesystem::remove_all(path_, ec);
+        }
+
+        scratch_dir(const scratch_dir&) = delete;
+        scratch_dir& operator=(const scratch_dir&) = delete;
+
+        const std::filesystem::path& path() const
+        {
+            return path_;
+        }
+
+        // creates the file (and any missing parents), relative to the scratch directory
+        std::filesystem::path file(const std::string& relative, const std::string& contents = "") const
+        {
+            const std::filesystem::path p = path_ / relative;
+            std::filesystem::create_directories(p.parent_path());
+            std::ofstream(p, std::ios::binary) << contents;
+            return p;
+        }
+
+        std::filesystem::path dir(const std::string& relative) const
+        {
+            const std::filesystem::path p = path_ / relative;
+            std::filesystem::create_directories(p);
+            return p;
+        }
+
+    private:
+        std::filesystem::path path_;
+    };
+}
+
+#define FSFIND_TEST_CONCAT2(a, b) a##b
+#define FSFIND_TEST_CONCAT(a, b) FSFIND_TEST_CONCAT2(a, b)
+
+#define TEST(name) \
+    static void name(); \
+    static fsfind_test::registrar FSFIND_TEST_CONCAT(register_, name)(#name, name); \
+    static void name()
+
+#define CHECK(expr) \
+    do { if (!(expr)) fsfind_test::fail(__FILE__, __LINE__, #expr); } while (0)
+
+#define CHECK_EQ(a, b) \
+    fsfind_test::check_equal((a), (b), #a, #b, __FILE__, __LINE__)
+
+#define CHECK_THROWS(expr, type) \
+    do { \
+        bool thrown = false; \
+        try { expr; } catch (const type&) { thrown = true; } \
+        if (!thrown) fsfind_test::fail(__FILE__, __LINE__, #expr " did not throw " #type); \
+    } while (0)
+
+#endif // FSFIND_TEST_UTIL_H